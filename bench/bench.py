@@ -0,0 +1,234 @@
+#!/usr/bin/env python3
+# 编译速度基准: 生成按各个维度放大的 SysY 程序, 用各个模式编译, 记录耗时和峰值内存
+# 用法: python3 bench/bench.py --compiler build/compiler [--out build/bench] [--scale 1]
+# 同一维度相邻两个规模之间的增长指数 log(t2/t1)/log(n2/n1) 明显大于 1 时标出来, 用来发现超线性的行为
+
+import argparse
+import csv
+import math
+import os
+import resource
+import subprocess
+import sys
+import time
+
+
+def gen_funcs(n):
+    # n 个小函数, main 依次调用
+    out = []
+    for i in range(n):
+        out.append('int f%d(int a, int b) {\n  int c = a * %d + b;\n  if (c > 100) c = c - 100;\n  return c;\n}\n' % (i, i % 13 + 1))
+    out.append('int main() {\n  int s = 0;\n')
+    for i in range(n):
+        out.append('  s = f%d(s, %d);\n' % (i, i % 17))
+    out.append('  return s % 256;\n}\n')
+    return ''.join(out)
+
+
+def gen_stmts(n):
+    # 一个函数里 n 条语句
+    body = [
+        '  a = a + b * 3;\n',
+        '  b = b - a / 7;\n',
+        '  if (a > b) a = a - b;\n',
+        '  c[%d] = a + b;\n',
+        '  b = b + c[%d];\n',
+    ]
+    out = ['int main() {\n  int a = 1;\n  int b = 2;\n  int c[16] = {};\n']
+    for i in range(n):
+        s = body[i % len(body)]
+        out.append(s % (i % 16) if '%d' in s else s)
+    out.append('  return (a + b) % 256;\n}\n')
+    return ''.join(out)
+
+
+def gen_blocks(n):
+    # n 个并列的语句块, 每个块里一条语句
+    out = ['int main() {\n  int a = 0;\n']
+    for i in range(n):
+        out.append('  { int b = a + %d; a = b; }\n' % (i % 7))
+    out.append('  return a % 256;\n}\n')
+    return ''.join(out)
+
+
+def gen_depth(n):
+    # if 和 while 交替嵌套 n 层
+    out = ['int main() {\n  int x = 0;\n  int y = 0;\n']
+    for i in range(n):
+        # 缩进封顶, 否则源文件大小随深度平方增长
+        indent = '  ' * min(i + 1, 8)
+        if i % 2 == 0:
+            out.append('%sif (x < %d) {\n%s  x = x + 1;\n' % (indent, i + 1, indent))
+        else:
+            out.append('%swhile (y < %d) {\n%s  y = y + 1;\n' % (indent, i + 1, indent))
+    for i in reversed(range(n)):
+        out.append('  ' * min(i + 1, 8) + '}\n')
+    out.append('  return (x + y) % 256;\n}\n')
+    return ''.join(out)
+
+
+def gen_expr(n):
+    # 一个有 n 个操作数的表达式
+    ops = [' + ', ' - ', ' * ', ' + ', ' / ', ' % ']
+    terms = []
+    for i in range(n):
+        if i % 3 == 0:
+            term = 'a'
+        elif i % 3 == 1:
+            term = '(b + %d)' % (i % 11 + 1)
+        else:
+            term = '%d' % (i % 9 + 1)
+        if i > 0:
+            op = ops[i % len(ops)]
+            # 除数用常量, 不会除零
+            if op in (' / ', ' % '):
+                term = '%d' % (i % 9 + 1)
+            terms.append(op)
+        terms.append(term)
+    return 'int main() {\n  int a = 3;\n  int b = 5;\n  int x = %s;\n  return x %% 256;\n}\n' % ''.join(terms)
+
+
+def array_init(n):
+    return ', '.join(str(i % 97) for i in range(n))
+
+
+def gen_global_array(n):
+    # 全局数组带完整的初始化列表, 另一个只初始化了开头
+    return ('int g[%d] = {%s};\nint z[%d] = {1, 2, 3};\n'
+            'int main() {\n  return (g[%d] + z[%d]) %% 256;\n}\n') % (n, array_init(n), n, n - 1, n - 1)
+
+
+def gen_local_array(n):
+    return ('int main() {\n  int l[%d] = {%s};\n  int z[%d] = {1, 2, 3};\n'
+            '  return (l[%d] + z[%d]) %% 256;\n}\n') % (n, array_init(n), n, n - 1, n - 1)
+
+
+def gen_array_2d(n):
+    # n x 16 的二维数组, 初始化列表用嵌套的花括号
+    rows = ', '.join('{%s}' % ', '.join(str((i * 16 + j) % 89) for j in range(16)) for i in range(n))
+    return ('int g[%d][16] = {%s};\n'
+            'int main() {\n  int l[%d][16] = {%s};\n  return (g[%d][15] + l[%d][15]) %% 256;\n}\n') % (n, rows, n, rows, n - 1, n - 1)
+
+
+DIMENSIONS = [
+    ('funcs', gen_funcs, [64, 256, 1024, 4096]),
+    ('stmts', gen_stmts, [256, 1024, 4096, 16384]),
+    ('blocks', gen_blocks, [256, 1024, 4096, 16384]),
+    ('depth', gen_depth, [16, 64, 256, 1024]),
+    ('expr', gen_expr, [256, 1024, 4096]),
+    ('global_array', gen_global_array, [1024, 4096, 16384, 65536]),
+    ('local_array', gen_local_array, [1024, 4096, 16384, 65536]),
+    ('array_2d', gen_array_2d, [64, 256, 1024]),
+]
+
+MODES = ['-koopa', '-riscv']
+
+
+def read_hwm(pid):
+    # 子进程当前的峰值 RSS (KB), 进程已经退出时返回 0
+    try:
+        with open('/proc/%d/status' % pid) as f:
+            for line in f:
+                if line.startswith('VmHWM:'):
+                    return int(line.split()[1])
+    except (OSError, ValueError):
+        pass
+    return 0
+
+
+def run_one(compiler, mode, src, dst, timeout):
+    # wait4 拿到的 ru_maxrss 在 exec 时会继承 fork 出来的 python 进程的峰值,
+    # 小输入的结果就只是 python 自己的大小. 所以运行时同时轮询 /proc 里的 VmHWM,
+    # ru_maxrss 不超过 python 自己的峰值时用轮询的结果
+    floor = resource.getrusage(resource.RUSAGE_SELF).ru_maxrss
+    start = time.perf_counter()
+    proc = subprocess.Popen([compiler, mode, src, '-o', dst], stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    deadline = start + timeout
+    hwm = 0
+    while True:
+        hwm = max(hwm, read_hwm(proc.pid))
+        pid, status, usage = os.wait4(proc.pid, os.WNOHANG)
+        if pid != 0:
+            break
+        if time.perf_counter() > deadline:
+            proc.kill()
+            os.wait4(proc.pid, 0)
+            return None, None, 'timeout'
+        time.sleep(0.001)
+    elapsed = time.perf_counter() - start
+    rss = usage.ru_maxrss if usage.ru_maxrss > floor else hwm
+    proc.returncode = os.waitstatus_to_exitcode(status)
+    if proc.returncode != 0:
+        return elapsed, rss, 'exit %d' % proc.returncode
+    return elapsed, rss, 'ok'
+
+
+def main():
+    parser = argparse.ArgumentParser(description='SysY compiler compile-time benchmark')
+    parser.add_argument('--compiler', default='build/compiler')
+    parser.add_argument('--out', default='build/bench')
+    parser.add_argument('--scale', type=float, default=1.0, help='multiply every size by this factor')
+    parser.add_argument('--repeat', type=int, default=3, help='runs per input, the fastest one is reported')
+    parser.add_argument('--timeout', type=float, default=120.0)
+    parser.add_argument('--only', default='', help='comma separated dimensions to run')
+    args = parser.parse_args()
+
+    only = set(filter(None, args.only.split(',')))
+    os.makedirs(args.out, exist_ok=True)
+    rows = []
+    superlinear = []
+    print('%-13s %8s %7s %10s %10s %10s  %s' % ('dimension', 'size', 'mode', 'bytes', 'time (s)', 'RSS (KB)', 'status'))
+    for name, gen, sizes in DIMENSIONS:
+        if only and name not in only:
+            continue
+        prev = {}
+        for size in sizes:
+            size = max(1, int(size * args.scale))
+            src = os.path.join(args.out, '%s_%d.sy' % (name, size))
+            with open(src, 'w') as f:
+                f.write(gen(size))
+            nbytes = os.path.getsize(src)
+            for mode in MODES:
+                dst = os.path.join(args.out, '%s_%d.%s' % (name, size, mode[1:]))
+                best_time, best_rss, status = None, None, 'ok'
+                for _ in range(args.repeat):
+                    elapsed, rss, status = run_one(args.compiler, mode, src, dst, args.timeout)
+                    if status != 'ok':
+                        break
+                    best_time = elapsed if best_time is None else min(best_time, elapsed)
+                    best_rss = rss if best_rss is None else max(best_rss, rss)
+                note = ''
+                if status == 'ok' and mode in prev:
+                    prev_size, prev_time = prev[mode]
+                    # 太短的时间误差大, 不算增长指数
+                    if prev_time > 0.01:
+                        exponent = math.log(best_time / prev_time) / math.log(size / prev_size)
+                        note = 'growth %.2f' % exponent
+                        if exponent > 1.3:
+                            note += ' SUPERLINEAR'
+                            superlinear.append('%s %s %d' % (name, mode, size))
+                if status == 'ok':
+                    prev[mode] = (size, best_time)
+                print('%-13s %8d %7s %10d %10s %10s  %s %s' % (
+                    name, size, mode[1:], nbytes,
+                    '%.4f' % best_time if best_time is not None else '-',
+                    best_rss if best_rss is not None else '-', status, note))
+                sys.stdout.flush()
+                rows.append([name, size, mode[1:], nbytes,
+                             '%.6f' % best_time if best_time is not None else '',
+                             best_rss if best_rss is not None else '', status])
+
+    result = os.path.join(args.out, 'results.csv')
+    with open(result, 'w', newline='') as f:
+        writer = csv.writer(f)
+        writer.writerow(['dimension', 'size', 'mode', 'source_bytes', 'time_s', 'max_rss_kb', 'status'])
+        writer.writerows(rows)
+    print('results written to %s' % result)
+    if superlinear:
+        print('super-linear growth at: %s' % ', '.join(superlinear))
+    failed = [r for r in rows if r[-1] != 'ok']
+    return 1 if failed else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,34 @@
+#include "arena.h"
+
+thread_local Arena ir_arena;
+
+void Arena::new_block()
+{
+    current = (char*)::operator new(BLOCK_SIZE);
+    blocks.push_back(current);
+    reserved += BLOCK_SIZE;
+    used = 0;
+    capacity = BLOCK_SIZE;
+}
+
+void* Arena::allocate_large(size_t size)
+{
+    // operator new 返回的内存满足基本类型的对齐要求
+    auto block = (char*)::operator new(size);
+    blocks.push_back(block);
+    reserved += size;
+    return block;
+}
+
+void Arena::release()
+{
+    for (auto block : blocks)
+        ::operator delete(block);
+    blocks.clear();
+    current = nullptr;
+    used = 0;
+    capacity = 0;
+    total_bytes = 0;
+    total_allocs = 0;
+    reserved = 0;
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// 一次编译用的 bump 分配器
+// IR 里的 value/type/slice/名字都是只增不删的 POD, 没必要一个个 new,
+// 全部从大块内存里顺序切出来, 编译结束时 release() 一次性归还
+class Arena
+{
+public:
+    Arena() = default;
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+    ~Arena() { release(); }
+
+    void* allocate(size_t size, size_t align)
+    {
+        total_bytes += size;
+        total_allocs++;
+        size_t offset = (used + align - 1) & ~(align - 1);
+        if (offset + size > capacity) {
+            // 特别大的请求单独给一块, 不浪费当前块剩下的空间
+            if (size > BLOCK_SIZE / 4)
+                return allocate_large(size);
+            new_block();
+            offset = 0;
+        }
+        used = offset + size;
+        return current + offset;
+    }
+
+    // 值初始化(清零)的对象, 用于之后逐个字段赋值的情况
+    template <typename T>
+    T* make()
+    {
+        static_assert(std::is_trivially_destructible<T>::value, "arena objects are never destroyed");
+        return new (allocate(sizeof(T), alignof(T))) T();
+    }
+
+    template <typename T>
+    T* make(const T& init)
+    {
+        static_assert(std::is_trivially_destructible<T>::value, "arena objects are never destroyed");
+        return new (allocate(sizeof(T), alignof(T))) T(init);
+    }
+
+    template <typename T>
+    T* make_array(size_t n)
+    {
+        static_assert(std::is_trivially_destructible<T>::value, "arena objects are never destroyed");
+        if (n == 0)
+            return nullptr;
+        return new (allocate(sizeof(T) * n, alignof(T))) T[n]();
+    }
+
+    char* copy_string(const char* s, size_t len)
+    {
+        auto result = (char*)allocate(len + 1, 1);
+        memcpy(result, s, len);
+        result[len] = '\0';
+        return result;
+    }
+    char* copy_string(const std::string& s) { return copy_string(s.data(), s.size()); }
+
+    // 归还所有内存, 之前分配出去的指针全部失效
+    void release();
+
+    // 统计信息
+    size_t bytes_allocated() const { return total_bytes; }
+    size_t allocation_count() const { return total_allocs; }
+    size_t bytes_reserved() const { return reserved; }
+
+private:
+    static const size_t BLOCK_SIZE = 1 << 20;
+
+    std::vector<char*> blocks;
+    char* current = nullptr;
+    size_t used = 0;
+    size_t capacity = 0;
+
+    size_t total_bytes = 0;
+    size_t total_allocs = 0;
+    size_t reserved = 0;
+
+    void new_block();
+    void* allocate_large(size_t size);
+};
+
+// IR 节点所在的 arena, 生命周期为一次编译, 每个线程一个
+extern thread_local Arena ir_arena;
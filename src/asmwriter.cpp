@@ -0,0 +1,119 @@
+#include "asmwriter.h"
+#include <algorithm>
+
+size_t AsmWriter::size() const
+{
+    size_t total = 0;
+    for (auto& chunk : chunks)
+        total += chunk.len;
+    if (current != nullptr)
+        total += cur - current.get();
+    return total;
+}
+
+void AsmWriter::flush(FILE* fp)
+{
+    for (auto& chunk : chunks)
+        fwrite(chunk.data.get(), 1, chunk.len, fp);
+    chunks.clear();
+    if (current != nullptr) {
+        fwrite(current.get(), 1, cur - current.get(), fp);
+        cur = current.get();
+    }
+    fflush(fp);
+}
+
+void AsmWriter::flush(std::string& out)
+{
+    out.reserve(out.size() + size());
+    for (auto& chunk : chunks)
+        out.append(chunk.data.get(), chunk.len);
+    chunks.clear();
+    if (current != nullptr) {
+        out.append(current.get(), cur - current.get());
+        cur = current.get();
+    }
+}
+
+void AsmWriter::clear()
+{
+    chunks.clear();
+    if (current != nullptr)
+        cur = current.get();
+}
+
+void AsmWriter::take(size_t mark, std::string& out)
+{
+    size_t offset = 0;
+    size_t first = chunks.size(); // mark 落在的已写满的块
+    for (size_t i = 0; i < chunks.size(); i++) {
+        auto& chunk = chunks[i];
+        if (first == chunks.size() && offset + chunk.len > mark) {
+            first = i;
+            out.append(chunk.data.get() + (mark - offset), chunk.len - (mark - offset));
+        } else if (first != chunks.size()) {
+            out.append(chunk.data.get(), chunk.len);
+        }
+        if (first == chunks.size())
+            offset += chunk.len;
+    }
+    if (current == nullptr)
+        return;
+    if (first == chunks.size()) {
+        char* start = current.get() + (mark - offset);
+        out.append(start, cur - start);
+        cur = start;
+        return;
+    }
+    // 截断到前面的块, 它成为新的当前块, 后面的都丢掉
+    out.append(current.get(), cur - current.get());
+    current = std::move(chunks[first].data);
+    cur = current.get() + (mark - offset);
+    end = current.get() + CHUNK_SIZE;
+    chunks.resize(first);
+}
+
+void AsmWriter::new_chunk()
+{
+    if (current != nullptr) {
+        // 先算长度, 花括号里从左到右求值, move 之后 current 就是空的了
+        size_t len = cur - current.get();
+        chunks.push_back({std::move(current), len});
+    }
+    current.reset(new char[CHUNK_SIZE]);
+    cur = current.get();
+    end = cur + CHUNK_SIZE;
+}
+
+void AsmWriter::write_slow(const char* s, size_t len)
+{
+    while (len > 0) {
+        if (cur == end)
+            new_chunk();
+        size_t n = std::min(len, (size_t)(end - cur));
+        memcpy(cur, s, n);
+        cur += n;
+        s += n;
+        len -= n;
+    }
+}
+
+void AsmWriter::write_signed(long long n)
+{
+    if (n < 0) {
+        *this << '-';
+        write_unsigned(0ull - (unsigned long long)n);
+    }
+    else write_unsigned(n);
+}
+
+void AsmWriter::write_unsigned(unsigned long long n)
+{
+    char buf[20];
+    char* p = buf + sizeof(buf);
+    do {
+        *--p = '0' + n % 10;
+        n /= 10;
+    } while (n != 0);
+    write(p, buf + sizeof(buf) - p);
+}
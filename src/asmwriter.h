@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+// 汇编输出缓冲
+// 之前每条指令都 std::cout << ... << std::endl, 每行都会 flush 一次 stdout,
+// 大输入时几乎全部时间都花在系统调用上. 这里改成追加到若干大块缓冲区里,
+// 整数自己格式化, 最后由 flush() 一次性写出.
+class AsmWriter
+{
+public:
+    AsmWriter() = default;
+    AsmWriter(const AsmWriter&) = delete;
+    AsmWriter& operator=(const AsmWriter&) = delete;
+
+    void write(const char* s, size_t len)
+    {
+        if (len <= (size_t)(end - cur)) {
+            memcpy(cur, s, len);
+            cur += len;
+            return;
+        }
+        write_slow(s, len);
+    }
+
+    AsmWriter& operator<<(const char* s)
+    {
+        write(s, strlen(s));
+        return *this;
+    }
+    AsmWriter& operator<<(const std::string& s)
+    {
+        write(s.data(), s.size());
+        return *this;
+    }
+    AsmWriter& operator<<(char c)
+    {
+        if (cur == end)
+            new_chunk();
+        *cur++ = c;
+        return *this;
+    }
+    AsmWriter& operator<<(int n) { write_signed(n); return *this; }
+    AsmWriter& operator<<(long n) { write_signed(n); return *this; }
+    AsmWriter& operator<<(long long n) { write_signed(n); return *this; }
+    AsmWriter& operator<<(unsigned int n) { write_unsigned(n); return *this; }
+    AsmWriter& operator<<(unsigned long n) { write_unsigned(n); return *this; }
+    AsmWriter& operator<<(unsigned long long n) { write_unsigned(n); return *this; }
+
+    // 已缓冲的字节数
+    size_t size() const;
+    // 把缓冲的内容全部写到 fp 并清空缓冲
+    void flush(FILE* fp);
+    // 把缓冲的内容追加到 out 并清空缓冲
+    void flush(std::string& out);
+    // 丢弃缓冲的内容
+    void clear();
+    // 把第 mark 个字节之后的内容追加到 out, 缓冲截断到 mark
+    void take(size_t mark, std::string& out);
+
+private:
+    static const size_t CHUNK_SIZE = 1 << 20;
+
+    struct Chunk {
+        std::unique_ptr<char[]> data;
+        size_t len;
+    };
+    std::vector<Chunk> chunks; // 已写满的块
+    std::unique_ptr<char[]> current;
+    char* cur = nullptr;
+    char* end = nullptr;
+
+    void new_chunk();
+    void write_slow(const char* s, size_t len);
+    void write_signed(long long n);
+    void write_unsigned(unsigned long long n);
+};
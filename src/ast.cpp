@@ -1,68 +1,71 @@
 #include "ast.h"
+#include <algorithm>
 #include "symtab.h"
+#include "arena.h"
+#include "types.h"
+#include "constpool.h"
+#include "compiler.h"
+
+// 正在生成的函数: 指令按顺序放在一个数组里, 每个有名字的基本块只记下自己的起点,
+// 函数结束时每个块一次性生成 slice. 数组的容量在函数之间复用, 追加是均摊 O(1) 的
+struct FuncBuilder {
+    struct Block {
+        koopa_raw_basic_block_data_t* bb;
+        size_t begin;
+        bool terminated;
+    };
+    std::vector<Block> blocks;
+    std::vector<const void*> insts;
+    // 放在入口块最前面的指令: 参数的 alloc/store, 以及编译器自己用的临时变量
+    std::vector<const void*> prologue;
+    // 局部数组清零循环的计数器, 整个函数共用一个
+    koopa_raw_value_data_t* fill_counter;
+
+    void clear()
+    {
+        blocks.clear();
+        insts.clear();
+        prologue.clear();
+        fill_counter = nullptr;
+    }
+};
 
-std::vector<koopa_raw_basic_block_data_t*> current_bbs;
-std::vector<koopa_raw_value_data_t*> current_values;
-std::vector<koopa_raw_value_data_t*> global_values;
+// 生成 IR 时的状态, 每个线程一份, 在 CompUnitAST::toRaw 开始时清空
+thread_local FuncBuilder current_func;
+thread_local std::vector<koopa_raw_value_data_t*> global_values;
 
-koopa_raw_type_kind_t* BaseAST::build_type_from_dim_vec(std::vector<int>* dim_vec)
+koopa_raw_type_t BaseAST::build_type_from_dim_vec(std::vector<int>* dim_vec)
 {
-    auto ty_integer = new koopa_raw_type_kind_t({
-        .tag = KOOPA_RTT_INT32,
-    });
-    koopa_raw_type_kind_t* temp_ty = ty_integer;
+    auto ty = RawType::i32();
     for (auto i : *dim_vec) {
-        auto ty_array = new koopa_raw_type_kind_t({
-            .tag = KOOPA_RTT_ARRAY,
-            .data = {
-                .array = {
-                    .base = temp_ty,
-                    .len = (unsigned long)i,
-                },
-            },
-        });
-        temp_ty = ty_array;
+        ty = RawType::array(ty, (unsigned long)i);
     }
-    return temp_ty;
+    return ty;
 }
 
 koopa_raw_value_data_t* BaseAST::build_number(int number, koopa_raw_value_data_t* user=nullptr)
 {
-    auto num = new koopa_raw_value_data_t({
-        .ty = new koopa_raw_type_kind_t({
-            .tag = KOOPA_RTT_INT32
-        }),
-        .name = nullptr,
-        .used_by = {
-            .buffer = nullptr,
-            .len = 0,
-            .kind = KOOPA_RSIK_VALUE,
-        },
-        .kind = {
-            .tag = KOOPA_RVT_INTEGER,
-            .data = {
-                .integer = {
-                    .value = number,
-                },
-            },
-        },
-    });
-
-    return num;
+    // 同一个值共用一个节点, 大数组清零时不会再生成成千上万个常量
+    return ConstPool::get(number);
 }
 
-char* BaseAST::build_ident(const std::string& ident, char c)
+char* BaseAST::build_ident(const char* ident, size_t len, char c)
 {
-    auto name = new char[ident.size() + 2];
+    auto name = ir_arena.make_array<char>(len + 2);
     name[0] = c;
-    std::copy(ident.begin(), ident.end(), name + 1);
-    name[ident.size() + 1] = '\0';
+    memcpy(name + 1, ident, len);
+    name[len + 1] = '\0';
     return name;
 }
 
+char* BaseAST::build_ident(ident_id ident, char c)
+{
+    return build_ident(Interner::name(ident), Interner::length(ident), c);
+}
+
 koopa_raw_basic_block_data_t* BaseAST::build_block_from_insts(std::vector<koopa_raw_value_data_t*>* insts=nullptr, const char* block_name=nullptr)
 {
-    auto raw_block = new koopa_raw_basic_block_data_t({
+    auto raw_block = ir_arena.make<koopa_raw_basic_block_data_t>({
         .name = block_name,
         .params = {
             .buffer = nullptr,
@@ -88,7 +91,7 @@ koopa_raw_basic_block_data_t* BaseAST::build_block_from_insts(std::vector<koopa_
         return raw_block;
     }
     raw_block->insts.len = insts->size();
-    raw_block->insts.buffer = new const void*[raw_block->insts.len];
+    raw_block->insts.buffer = ir_arena.make_array<const void*>(raw_block->insts.len);
     for (int i = 0; i < raw_block->insts.len; i++) {
         raw_block->insts.buffer[i] = insts->at(i);
     }
@@ -97,10 +100,8 @@ koopa_raw_basic_block_data_t* BaseAST::build_block_from_insts(std::vector<koopa_
 
 koopa_raw_value_data_t* BaseAST::build_jump(koopa_raw_basic_block_t target, koopa_raw_slice_t* args=nullptr)
 {
-    auto raw_jump = new koopa_raw_value_data_t({
-        .ty = new koopa_raw_type_kind_t({
-            .tag = KOOPA_RTT_UNIT
-        }),
+    auto raw_jump = ir_arena.make<koopa_raw_value_data_t>({
+        .ty = RawType::unit(),
         .name = nullptr,
         .used_by = {
             .buffer = nullptr,
@@ -128,39 +129,6 @@ koopa_raw_value_data_t* BaseAST::build_jump(koopa_raw_basic_block_t target, koop
     return raw_jump;
 }
 
-koopa_raw_slice_t BaseAST::combine_slices(koopa_raw_slice_t& s1, koopa_raw_slice_t& s2)
-{
-    koopa_raw_slice_t result;
-    result.len = s1.len + s2.len;
-    result.buffer = new const void*[result.len];
-    result.kind = s1.kind;
-    for (int i = 0; i < s1.len; i++) {
-        result.buffer[i] = s1.buffer[i];
-    }
-    for (int i = 0; i < s2.len; i++) {
-        result.buffer[i+s1.len] = s2.buffer[i];
-    }
-    return result;
-}
-
-void BaseAST::filter_basic_block(koopa_raw_basic_block_data_t* bb)
-{
-    auto insts = new std::vector<koopa_raw_value_data*>();
-    for (int i = 0; i < bb->insts.len; i++) {
-        auto inst = (koopa_raw_value_data*)bb->insts.buffer[i];
-        if (inst != nullptr && inst->kind.tag != KOOPA_RVT_INTEGER && inst->kind.tag != KOOPA_RVT_BLOCK_ARG_REF) {
-            insts->push_back(inst);
-            if (inst->kind.tag == KOOPA_RVT_RETURN || inst->kind.tag == KOOPA_RVT_BRANCH || inst->kind.tag == KOOPA_RVT_JUMP)
-                break;
-        }
-    }
-    bb->insts.len = insts->size();
-    bb->insts.buffer = new const void*[bb->insts.len];
-    for (int i = 0; i < bb->insts.len; i++) {
-        bb->insts.buffer[i] = insts->at(i);
-    }
-}
-
 koopa_raw_value_data_t* BaseAST::build_branch(
     koopa_raw_value_data* cond,
     koopa_raw_basic_block_data_t* true_bb,
@@ -169,10 +137,8 @@ koopa_raw_value_data_t* BaseAST::build_branch(
     koopa_raw_slice_t* false_args=nullptr
 ) 
 {
-    auto raw_stmt = new koopa_raw_value_data_t({
-        .ty = new koopa_raw_type_kind_t({
-            .tag = KOOPA_RTT_UNIT
-        }),
+    auto raw_stmt = ir_arena.make<koopa_raw_value_data_t>({
+        .ty = RawType::unit(),
         .name = nullptr,
         .used_by = {
             .buffer = nullptr,
@@ -211,15 +177,8 @@ koopa_raw_value_data_t* BaseAST::build_branch(
 
 koopa_raw_value_data_t* BaseAST::build_alloc(const char* name)
 {
-    auto raw_alloc = new koopa_raw_value_data_t({
-        .ty = new koopa_raw_type_kind_t({
-            .tag = KOOPA_RTT_POINTER,
-            .data = {
-                .pointer = {
-                    .base = new koopa_raw_type_kind_t({.tag = KOOPA_RTT_INT32}),
-                }
-            },
-        }),
+    auto raw_alloc = ir_arena.make<koopa_raw_value_data_t>({
+        .ty = RawType::pointer(RawType::i32()),
         .name = name,
         .used_by = {
             .buffer = nullptr,
@@ -236,10 +195,8 @@ koopa_raw_value_data_t* BaseAST::build_alloc(const char* name)
 
 koopa_raw_value_data_t* BaseAST::build_store(koopa_raw_value_data_t* value, koopa_raw_value_data_t* dest)
 {
-    auto raw_store = new koopa_raw_value_data_t({
-        .ty = new koopa_raw_type_kind_t({
-            .tag = KOOPA_RTT_INT32,
-        }),
+    auto raw_store = ir_arena.make<koopa_raw_value_data_t>({
+        .ty = RawType::i32(),
         .name = nullptr,
         .used_by = {
             .buffer = nullptr,
@@ -266,18 +223,18 @@ koopa_raw_function_data_t* BaseAST::build_function(
     std::string ret
 )
 {
-    auto ret_ty = new koopa_raw_type_kind_t;
+    koopa_raw_type_t ret_ty = nullptr;
     if (ret == "void") {
-        ret_ty->tag = KOOPA_RTT_UNIT;
+        ret_ty = RawType::unit();
     }
     else if (ret == "int") {
-        ret_ty->tag = KOOPA_RTT_INT32;
+        ret_ty = RawType::i32();
     }
     else {
         assert(false);
     }
-    auto raw_function = new koopa_raw_function_data_t({
-        .name = build_ident(name, '@'),
+    auto raw_function = ir_arena.make<koopa_raw_function_data_t>({
+        .name = build_ident(name, strlen(name), '@'),
         .params = {
             .buffer = nullptr,
             .len = 0,
@@ -290,113 +247,60 @@ koopa_raw_function_data_t* BaseAST::build_function(
         },
     });
 
-    auto ty = new koopa_raw_type_kind_t({
-        .tag = KOOPA_RTT_FUNCTION,
-        .data = {
-            .function = {
-                .params = {
-                    .buffer = new const void*[params.size()],
-                    .len = (unsigned int)params.size(),
-                    .kind = KOOPA_RSIK_TYPE,
-                },
-                .ret = ret_ty,
-            },
-        },
-    });
-
-    Symbol::insert(name, Symbol::TYPE_FUNCTION, raw_function);
+    Symbol::insert(Interner::intern(name), Symbol::TYPE_FUNCTION, raw_function);
 
+    std::vector<koopa_raw_type_t> param_tys;
     for (int i = 0; i < params.size(); i++) {
         auto param = params[i];
-        koopa_raw_type_kind_t* raw_param_ty = nullptr;
+        koopa_raw_type_t raw_param_ty = nullptr;
         if (param == "int")
-            raw_param_ty = new koopa_raw_type_kind_t({
-                .tag = KOOPA_RTT_INT32
-            });
+            raw_param_ty = RawType::i32();
         else if (param == "p2i") {
-            raw_param_ty = new koopa_raw_type_kind_t({
-                .tag = KOOPA_RTT_POINTER,
-                .data = {
-                    .pointer = {
-                        .base = new koopa_raw_type_kind_t({
-                            .tag = KOOPA_RTT_INT32
-                        }),
-                    }
-                },
-            });
+            raw_param_ty = RawType::pointer(RawType::i32());
         }
         else assert(false);
-        ty->data.function.params.buffer[i] = raw_param_ty;
+        param_tys.push_back(raw_param_ty);
     }
 
-    raw_function->ty = ty;
+    raw_function->ty = RawType::function(param_tys, ret_ty);
     
     return raw_function;
 }
 
-koopa_raw_value_data_t* BaseAST::build_aggregate(std::vector<int>* dim_vec, std::vector<int>* result_vec)
+static koopa_raw_value_data_t* build_zero_init(koopa_raw_type_t ty)
 {
-    bool all_zero = true;
-    for (auto i : *result_vec) {
-        if (i != 0) {
-            all_zero = false;
-            break;
-        }
-    }
-    if (all_zero) {
-        return new koopa_raw_value_data_t({
-            .ty = build_type_from_dim_vec(dim_vec),
-            .name = nullptr,
-            .used_by = {
-                .buffer = nullptr,
-                .len = 0,
-                .kind = KOOPA_RSIK_VALUE,
-            },
-            .kind = {
-                .tag = KOOPA_RVT_ZERO_INIT,
-            },
-        });
-    }
-    int dim = dim_vec->back();
-    if (dim_vec->size() == 1) {
-        auto raw_aggregate = new koopa_raw_value_data_t({
-            .ty = new koopa_raw_type_kind_t({
-                .tag = KOOPA_RTT_ARRAY,
-                .data = {
-                    .array = {
-                        .base = new koopa_raw_type_kind_t({
-                            .tag = KOOPA_RTT_INT32,
-                        }),
-                        .len = (unsigned long)dim,
-                    },
-                },
-            }),
-            .name = nullptr,
-            .used_by = {
-                .buffer = nullptr,
-                .len = 0,
-                .kind = KOOPA_RSIK_VALUE,
-            },
-            .kind = {
-                .tag = KOOPA_RVT_AGGREGATE,
-                .data = {
-                    .aggregate = {
-                        .elems = {
-                            .buffer = new const void*[dim],
-                            .len = (unsigned int)dim,
-                            .kind = KOOPA_RSIK_VALUE,
-                        },
-                    },
-                },
-            },
-        });
-        for (int i = 0; i < dim; i++) {
-            raw_aggregate->kind.data.aggregate.elems.buffer[i] = build_number(result_vec->at(i));
-        }
-        return raw_aggregate;
-    }
-    auto raw_aggregate = new koopa_raw_value_data_t({
-        .ty = build_type_from_dim_vec(dim_vec),
+    return ir_arena.make<koopa_raw_value_data_t>({
+        .ty = ty,
+        .name = nullptr,
+        .used_by = {
+            .buffer = nullptr,
+            .len = 0,
+            .kind = KOOPA_RSIK_VALUE,
+        },
+        .kind = {
+            .tag = KOOPA_RVT_ZERO_INIT,
+        },
+    });
+}
+
+// types[i] 是由内向外前 i+1 维组成的数组类型, sub_lens[i] 是第 i 维每个元素展开后的长度
+// [begin, end) 是落在 [base, base + sub_lens[level] * dim) 里的非 0 元素
+static koopa_raw_value_data_t* build_aggregate_range(
+    const std::vector<int>& dims,
+    const std::vector<koopa_raw_type_t>& types,
+    const std::vector<int>& sub_lens,
+    int level,
+    int base,
+    const std::pair<int, int>* begin,
+    const std::pair<int, int>* end
+)
+{
+    if (begin == end)
+        return build_zero_init(types[level]);
+    int dim = dims[level];
+    int sub_len = sub_lens[level];
+    auto raw_aggregate = ir_arena.make<koopa_raw_value_data_t>({
+        .ty = types[level],
         .name = nullptr,
         .used_by = {
             .buffer = nullptr,
@@ -408,7 +312,7 @@ koopa_raw_value_data_t* BaseAST::build_aggregate(std::vector<int>* dim_vec, std:
             .data = {
                 .aggregate = {
                     .elems = {
-                        .buffer = new const void*[dim],
+                        .buffer = ir_arena.make_array<const void*>(dim),
                         .len = (unsigned int)dim,
                         .kind = KOOPA_RSIK_VALUE,
                     },
@@ -416,36 +320,65 @@ koopa_raw_value_data_t* BaseAST::build_aggregate(std::vector<int>* dim_vec, std:
             },
         },
     });
-    auto sub_dim_vec = new std::vector<int>(dim_vec->begin(), dim_vec->end() - 1);
-    int sub_len = 1;
-    for (auto i : *sub_dim_vec) {
-        sub_len *= i;
-    }
+    auto elems = raw_aggregate->kind.data.aggregate.elems.buffer;
+    auto it = begin;
     for (int i = 0; i < dim; i++) {
-        auto sub_vector = new std::vector<int>(result_vec->begin() + i * sub_len, result_vec->begin() + (i + 1) * sub_len);
-        raw_aggregate->kind.data.aggregate.elems.buffer[i] = build_aggregate(sub_dim_vec, sub_vector);
+        int hi = base + (i + 1) * sub_len;
+        auto sub_end = it;
+        while (sub_end != end && sub_end->first < hi)
+            sub_end++;
+        if (level == 0)
+            elems[i] = BaseAST::build_number(it != sub_end ? it->second : 0, nullptr);
+        else
+            elems[i] = build_aggregate_range(dims, types, sub_lens, level - 1, hi - sub_len, it, sub_end);
+        it = sub_end;
     }
-        
     return raw_aggregate;
 }
 
-koopa_raw_value_data_t* BaseAST::build_aggregate(std::vector<int>* dim_vec, std::vector<koopa_raw_value_data_t*>* result_vec)
+static int array_size(std::vector<int>* dim_vec)
+{
+    int len = 1;
+    for (auto i : *dim_vec)
+        len *= i;
+    return len;
+}
+
+koopa_raw_value_data_t* BaseAST::build_aggregate(std::vector<int>* dim_vec, const InitList<int>& init)
 {
-    auto int_vec = new std::vector<int>();
-    for (auto i : *result_vec) {
-        auto inst = (koopa_raw_value_data_t*)i;
-        assert(inst->kind.tag == KOOPA_RVT_INTEGER);
-        int_vec->push_back(inst->kind.data.integer.value);
+    if (init.len != array_size(dim_vec))
+        throw CompileError("excess elements in array initializer");
+    std::vector<koopa_raw_type_t> types;
+    std::vector<int> sub_lens;
+    auto ty = RawType::i32();
+    int sub_len = 1;
+    for (auto i : *dim_vec) {
+        ty = RawType::array(ty, (unsigned long)i);
+        types.push_back(ty);
+        sub_lens.push_back(sub_len);
+        sub_len *= i;
     }
-    return build_aggregate(dim_vec, int_vec);
+    auto data = init.elems.data();
+    return build_aggregate_range(*dim_vec, types, sub_lens, dim_vec->size() - 1, 0, data, data + init.elems.size());
+}
+
+koopa_raw_value_data_t* BaseAST::build_aggregate(std::vector<int>* dim_vec, const InitList<koopa_raw_value_data_t*>& init)
+{
+    InitList<int> int_init;
+    int_init.len = init.len;
+    for (auto& elem : init.elems) {
+        auto inst = elem.second;
+        if (inst->kind.tag != KOOPA_RVT_INTEGER)
+            throw CompileError("initializer of global array is not a constant");
+        int_init.elems.push_back({elem.first, inst->kind.data.integer.value});
+    }
+    return build_aggregate(dim_vec, int_init);
 }
 
 koopa_raw_value_data_t* BaseAST::build_binary(koopa_raw_binary_op op, koopa_raw_value_data_t* lhs, koopa_raw_value_data_t* rhs)
 {
-    auto binary = new koopa_raw_value_data_t({
-        .ty = new koopa_raw_type_kind_t({
-            .tag = KOOPA_RTT_INT32,
-        }),
+    auto binary = ir_arena.make<koopa_raw_value_data_t>({
+        .ty = RawType::i32(),
         .name = nullptr,
         .used_by = {
             .buffer = nullptr,
@@ -468,7 +401,7 @@ koopa_raw_value_data_t* BaseAST::build_binary(koopa_raw_binary_op op, koopa_raw_
 
 koopa_raw_value_data_t* BaseAST::build_get_ptr(koopa_raw_value_data_t* src, koopa_raw_value_data_t* index)
 {
-    auto get_ptr = new koopa_raw_value_data_t({
+    auto get_ptr = ir_arena.make<koopa_raw_value_data_t>({
         .ty = src->ty,
         .name = nullptr,
         .used_by = {
@@ -491,15 +424,8 @@ koopa_raw_value_data_t* BaseAST::build_get_ptr(koopa_raw_value_data_t* src, koop
 
 koopa_raw_value_data_t* BaseAST::build_get_elem_ptr(koopa_raw_value_data_t* src, koopa_raw_value_data_t* index)
 {
-    auto get_elem_ptr = new koopa_raw_value_data_t({
-        .ty = new koopa_raw_type_kind_t({
-            .tag = KOOPA_RTT_POINTER,
-            .data = {
-                .pointer = {
-                    .base = src->ty->data.pointer.base->data.array.base,
-                },
-            },
-        }),
+    auto get_elem_ptr = ir_arena.make<koopa_raw_value_data_t>({
+        .ty = RawType::pointer(src->ty->data.pointer.base->data.array.base),
         .name = nullptr,
         .used_by = {
             .buffer = nullptr,
@@ -519,63 +445,137 @@ koopa_raw_value_data_t* BaseAST::build_get_elem_ptr(koopa_raw_value_data_t* src,
     return get_elem_ptr;
 }
 
-void BaseAST::store2array(koopa_raw_value_data_t* src, std::vector<koopa_raw_value_data*>* values, std::vector<int>* dims)
+koopa_raw_value_data_t* BaseAST::build_load(koopa_raw_value_data_t* src)
 {
-    if (dims->size() == 1) {
-        assert(values->size() == dims->back());
-        for (int i = 0; i < dims->back(); i++) {
-            auto get_elem_ptr = build_get_elem_ptr(src, build_number(i));
-            auto store = build_store(values->at(i), get_elem_ptr);
-            append_value(get_elem_ptr);
-            append_value(store);
-        }
-    }
-    else {
-        assert(values->size() % dims->back() == 0);
-        int sub_len = values->size() / dims->back();
-        for (int i = 0; i < dims->back(); i++) {
-            auto sub_values = new std::vector<koopa_raw_value_data*>(values->begin() + i * sub_len, values->begin() + (i + 1) * sub_len);
-            auto get_elem_ptr = build_get_elem_ptr(src, build_number(i));
-            append_value(get_elem_ptr);
-            store2array(get_elem_ptr, sub_values, new std::vector<int>(dims->begin(), dims->end() - 1));
-        }
-    }
+    auto load = ir_arena.make<koopa_raw_value_data_t>({
+        .ty = src->ty->data.pointer.base,
+        .name = nullptr,
+        .used_by = {
+            .buffer = nullptr,
+            .len = 0,
+            .kind = KOOPA_RSIK_VALUE,
+        },
+        .kind = {
+            .tag = KOOPA_RVT_LOAD,
+            .data = {
+                .load = {
+                    .src = src,
+                },
+            },
+        },
+    });
+    return load;
 }
 
-void BaseAST::store2array(koopa_raw_value_data_t* src, std::vector<int>* values, std::vector<int>* dims)
+// 0 的个数不少于这么多时才生成清零循环, 否则直接逐个 store 更短
+static const int ZERO_FILL_MIN = 16;
+
+void BaseAST::zero_fill(koopa_raw_value_data_t* base, int len)
 {
-    auto new_values = new std::vector<koopa_raw_value_data_t*>();
-    for (auto i : *values) {
-        new_values->push_back(build_number(i));
-    }
-    store2array(src, new_values, dims);
+    // 循环体里连续清零 unroll 个元素, 计数器每次加 unroll
+    int unroll = len % 4 == 0 ? 4 : len % 2 == 0 ? 2 : 1;
+    if (current_func.fill_counter == nullptr) {
+        current_func.fill_counter = build_alloc("%zero_fill_i");
+        current_func.prologue.push_back(current_func.fill_counter);
+    }
+    auto counter = current_func.fill_counter;
+    auto body_bb = build_block_from_insts(nullptr, "%zero_fill_body");
+    auto end_bb = build_block_from_insts(nullptr, "%zero_fill_end");
+
+    // len > 0, 所以先执行一次循环体, 条件放在末尾
+    append_value(build_store(build_number(0), counter));
+    append_value(build_jump(body_bb));
+    append_bb(body_bb);
+    auto index = build_load(counter);
+    append_value(index);
+    auto ptr = build_get_ptr(base, index);
+    append_value(ptr);
+    append_value(build_store(build_number(0), ptr));
+    for (int i = 1; i < unroll; i++) {
+        auto next_ptr = build_get_ptr(ptr, build_number(i));
+        append_value(next_ptr);
+        append_value(build_store(build_number(0), next_ptr));
+    }
+    auto next = build_binary(KOOPA_RBO_ADD, index, build_number(unroll));
+    append_value(next);
+    append_value(build_store(next, counter));
+    auto cond = build_binary(KOOPA_RBO_LT, next, build_number(len));
+    append_value(cond);
+    append_value(build_branch(cond, body_bb, end_bb));
+    append_bb(end_bb);
 }
 
-void append_value(koopa_raw_value_data_t* value)
+void BaseAST::store2array(koopa_raw_value_data_t* src, const InitList<koopa_raw_value_data_t*>& init, std::vector<int>* dims)
 {
-    current_values.push_back(value);
+    int len = array_size(dims);
+    if (init.len != len)
+        throw CompileError("excess elements in array initializer");
+    int zeros = len - init.elems.size();
+
+    // 按行优先的顺序, 第 k 个元素就是展平后 *i32 的第 k 个
+    auto base = src;
+    for (size_t i = 0; i < dims->size(); i++) {
+        base = build_get_elem_ptr(base, build_number(0));
+        append_value(base);
+    }
+    auto store = [base](int index, koopa_raw_value_data_t* value) {
+        auto ptr = base;
+        if (index != 0) {
+            ptr = build_get_ptr(base, build_number(index));
+            append_value(ptr);
+        }
+        append_value(build_store(value, ptr));
+    };
+    if (zeros >= ZERO_FILL_MIN) {
+        zero_fill(base, len);
+        for (auto& elem : init.elems)
+            store(elem.first, elem.second);
+        return;
+    }
+    // 0 很少, 逐个写
+    auto it = init.elems.begin();
+    for (int i = 0; i < len; i++) {
+        if (it != init.elems.end() && it->first == i)
+            store(i, (it++)->second);
+        else
+            store(i, build_number(0));
+    }
 }
 
-void end_block()
+void append_value(koopa_raw_value_data_t* value)
 {
-    auto last_bb = BaseAST::build_block_from_insts(&current_values);
-    current_values.clear();
-    current_bbs.push_back(last_bb);
+    // 常量和块参数的引用不是指令, 不放进基本块
+    if (value == nullptr || value->kind.tag == KOOPA_RVT_INTEGER || value->kind.tag == KOOPA_RVT_BLOCK_ARG_REF)
+        return;
+    assert(!current_func.blocks.empty());
+    auto& block = current_func.blocks.back();
+    // 终结指令之后的都是死代码
+    if (block.terminated)
+        return;
+    current_func.insts.push_back(value);
+    auto tag = value->kind.tag;
+    if (tag == KOOPA_RVT_RETURN || tag == KOOPA_RVT_BRANCH || tag == KOOPA_RVT_JUMP)
+        block.terminated = true;
 }
 
 void append_bb(koopa_raw_basic_block_data_t* bb)
 {
-    end_block();
-    current_bbs.push_back(bb);
+    // 没有名字的块(嵌套的语句块)不单独成块, 之后的指令接着放进前一个块
+    if (bb->name == nullptr)
+        return;
+    current_func.blocks.push_back({bb, current_func.insts.size(), false});
 }
 
 void *CompUnitAST::toRaw(int n = 0, void* args[] = nullptr) const
 {
-    auto raw_program = new koopa_raw_program_t;
+    auto raw_program = ir_arena.make<koopa_raw_program_t>();
 
     std::vector<koopa_raw_function_data_t*> funcs;
 
+    current_func.clear();
+    global_values.clear();
     Symbol::enter_scope();
+    ConstPool::reset();
 
     funcs.push_back(build_function("getint", {}, "int"));
     funcs.push_back(build_function("getch", {}, "int"));
@@ -593,14 +593,14 @@ void *CompUnitAST::toRaw(int n = 0, void* args[] = nullptr) const
     }
 
     raw_program->values.len = global_values.size();
-    raw_program->values.buffer = new const void*[raw_program->values.len];
+    raw_program->values.buffer = ir_arena.make_array<const void*>(raw_program->values.len);
     raw_program->values.kind = KOOPA_RSIK_VALUE;
     for (int i = 0; i < global_values.size(); i++) {
         raw_program->values.buffer[i] = global_values[i];
     }
 
     raw_program->funcs.len = funcs.size();
-    raw_program->funcs.buffer = new const void*[raw_program->funcs.len];
+    raw_program->funcs.buffer = ir_arena.make_array<const void*>(raw_program->funcs.len);
     raw_program->funcs.kind = KOOPA_RSIK_FUNCTION;
     for (int i = 0; i < funcs.size(); i++) {
         raw_program->funcs.buffer[i] = funcs[i];
@@ -628,125 +628,108 @@ void *GlobalDefAST::toRaw(int n = 0, void* args[] = nullptr) const
 
 void *FuncDefAST::toRaw(int n = 0, void* args[] = nullptr) const
 {
-    auto raw_function = new koopa_raw_function_data_t;
-    auto ty = new koopa_raw_type_kind_t;
-    ty->tag = KOOPA_RTT_FUNCTION;
-    ty->data.function.params.len = raw_function->params.len = func_f_param_list->size();
-    ty->data.function.params.buffer = new const void*[func_f_param_list->size()];
-    raw_function->params.buffer = new const void*[func_f_param_list->size()];
-    ty->data.function.params.kind = KOOPA_RSIK_TYPE;
+    auto raw_function = ir_arena.make<koopa_raw_function_data_t>();
+    raw_function->params.len = func_f_param_list->size();
+    raw_function->params.buffer = ir_arena.make_array<const void*>(func_f_param_list->size());
     raw_function->params.kind = KOOPA_RSIK_VALUE;
 
-    auto ret_ty = new koopa_raw_type_kind_t;
+    koopa_raw_type_t ret_ty = nullptr;
     if (func_type == "void") {
-        ret_ty->tag = KOOPA_RTT_UNIT;
+        ret_ty = RawType::unit();
     }
     else if (func_type == "int") {
-        ret_ty->tag = KOOPA_RTT_INT32;
+        ret_ty = RawType::i32();
     }
     else {
         assert(false);
     }
-    ty->data.function.ret = ret_ty;
 
     Symbol::insert(ident, Symbol::TYPE_FUNCTION, raw_function);
     Symbol::enter_scope();
+    // 函数内的常量单独一个池
+    ConstPool::reset();
 
-    auto var_decl_insts = new std::vector<koopa_raw_value_data*>();
+    current_func.clear();
+    auto& prologue = current_func.prologue;
+    std::vector<koopa_raw_type_t> param_tys;
 
     for (int i = 0; i < func_f_param_list->size(); i++) {
         auto f_param = (koopa_raw_value_data_t*)func_f_param_list->at(i)->toRaw(i);
+        auto param_ident = ((FuncFParamAST*)func_f_param_list->at(i).get())->ident;
         raw_function->params.buffer[i] = f_param;
-        ty->data.function.params.buffer[i] = f_param->ty;
+        param_tys.push_back(f_param->ty);
         switch (f_param->ty->tag) {
             case KOOPA_RTT_INT32:
             {
-                auto raw_alloc = build_alloc(build_ident(f_param->name + 1, '%'));
-                var_decl_insts->push_back(raw_alloc);
-                var_decl_insts->push_back(build_store(f_param, raw_alloc));
-                Symbol::insert(f_param->name + 1, Symbol::TYPE_VAR, raw_alloc);
+                auto raw_alloc = build_alloc(build_ident(param_ident, '%'));
+                prologue.push_back(raw_alloc);
+                prologue.push_back(build_store(f_param, raw_alloc));
+                Symbol::insert(param_ident, Symbol::TYPE_VAR, raw_alloc);
             }
             break;
             case KOOPA_RTT_POINTER:
             {
-                auto raw_alloc = build_alloc(build_ident(f_param->name + 1, '%'));
-                raw_alloc->ty = new koopa_raw_type_kind({
-                    .tag = KOOPA_RTT_POINTER,
-                    .data = {
-                        .pointer = {
-                            .base = f_param->ty,
-                        },
-                    },
-                });
-                var_decl_insts->push_back(raw_alloc);
-                var_decl_insts->push_back(build_store(f_param, raw_alloc));
-                Symbol::insert(f_param->name + 1, Symbol::TYPE_POINTER, raw_alloc);
+                auto raw_alloc = build_alloc(build_ident(param_ident, '%'));
+                raw_alloc->ty = RawType::pointer(f_param->ty);
+                prologue.push_back(raw_alloc);
+                prologue.push_back(build_store(f_param, raw_alloc));
+                Symbol::insert(param_ident, Symbol::TYPE_POINTER, raw_alloc);
             }
             break;
             default:
                 assert(false);
         }
     }
-    raw_function->ty = ty;
+    raw_function->ty = RawType::function(param_tys, ret_ty);
     raw_function->name = build_ident(ident, '@');
-    current_bbs.clear();
     block->toRaw(-1);
-    end_block();
-    auto filtered_bbs = std::vector<koopa_raw_basic_block_data_t*>();
-    for (auto block_bb : current_bbs) {
-        if (block_bb->insts.len == 0 && block_bb->name == nullptr) {
-            // delete block_bb;
-            continue;
-        }
-        else if (block_bb->name == nullptr) {
-            auto last = filtered_bbs.back();
-            last->insts = combine_slices(last->insts, block_bb->insts);
-        }
-        else filtered_bbs.push_back(block_bb);
-    }
-    raw_function->bbs.len = filtered_bbs.size();
-    raw_function->bbs.buffer = new const void*[raw_function->bbs.len];
-    raw_function->bbs.kind = KOOPA_RSIK_BASIC_BLOCK;
-    for (int i = 0; i < filtered_bbs.size(); i++) {
-        filter_basic_block(filtered_bbs[i]);
-        char *bb_name = new char[strlen(filtered_bbs[i]->name) + ident.length() + 2];
-        memset(bb_name, 0, strlen(filtered_bbs[i]->name) + ident.length() + 2);
-        bb_name[0] = '%';
-        strcat(bb_name, ident.c_str());
-        strcat(bb_name, "_");
-        strcat(bb_name, filtered_bbs[i]->name + 1);
-        filtered_bbs[i]->name = bb_name;
-        raw_function->bbs.buffer[i] = filtered_bbs[i];
-    }
-
-    auto first_bb = (koopa_raw_basic_block_data_t*)raw_function->bbs.buffer[0];
-    auto vec_def_bb = build_block_from_insts(var_decl_insts);
-    first_bb->insts = combine_slices(vec_def_bb->insts, first_bb->insts);
 
-    auto last_bb = (koopa_raw_basic_block_data_t*)raw_function->bbs.buffer[raw_function->bbs.len-1];
-    if (last_bb->insts.len == 0 || ((koopa_raw_value_data_t*)(last_bb->insts.buffer[last_bb->insts.len-1]))->kind.tag != KOOPA_RVT_RETURN) {
-        last_bb->insts.len += 1;
-        auto buffer = new const void*[last_bb->insts.len];
-        for (int i = 0; i < last_bb->insts.len - 1; i++) {
-            buffer[i] = last_bb->insts.buffer[i];
-        }
-        last_bb->insts.buffer = buffer;
-        auto raw_ret = new koopa_raw_value_data;
-        auto ty = new koopa_raw_type_kind_t;
-        ty->tag = KOOPA_RTT_UNIT;
-        raw_ret->ty = ty;
+    // 最后一个块没有终结指令时补上 return
+    if (!current_func.blocks.back().terminated) {
+        auto raw_ret = ir_arena.make<koopa_raw_value_data_t>();
+        raw_ret->ty = RawType::unit();
         raw_ret->name = nullptr;
         raw_ret->kind.tag = KOOPA_RVT_RETURN;
-        if (raw_function->ty->data.function.ret->tag == KOOPA_RTT_UNIT) {
+        if (ret_ty->tag == KOOPA_RTT_UNIT) {
             raw_ret->kind.data.ret.value = nullptr;
         }
-        else if (raw_function->ty->data.function.ret->tag == KOOPA_RTT_INT32) {
+        else if (ret_ty->tag == KOOPA_RTT_INT32) {
             raw_ret->kind.data.ret.value = build_number(0);
         }
         else assert(false);
-        buffer[last_bb->insts.len-1] = raw_ret;
+        append_value(raw_ret);
     }
 
+    auto& blocks = current_func.blocks;
+    auto& insts = current_func.insts;
+    raw_function->bbs.len = blocks.size();
+    raw_function->bbs.buffer = ir_arena.make_array<const void*>(raw_function->bbs.len);
+    raw_function->bbs.kind = KOOPA_RSIK_BASIC_BLOCK;
+    for (size_t i = 0; i < blocks.size(); i++) {
+        auto bb = blocks[i].bb;
+        size_t begin = blocks[i].begin;
+        size_t end = i + 1 < blocks.size() ? blocks[i + 1].begin : insts.size();
+        size_t prefix = i == 0 ? prologue.size() : 0;
+        bb->insts.len = prefix + (end - begin);
+        bb->insts.buffer = ir_arena.make_array<const void*>(bb->insts.len);
+        bb->insts.kind = KOOPA_RSIK_VALUE;
+        for (size_t j = 0; j < prefix; j++)
+            bb->insts.buffer[j] = prologue[j];
+        std::copy(insts.begin() + begin, insts.begin() + end, bb->insts.buffer + prefix);
+
+        size_t name_len = strlen(bb->name) + Interner::length(ident) + 2;
+        char *bb_name = ir_arena.make_array<char>(name_len);
+        memset(bb_name, 0, name_len);
+        bb_name[0] = '%';
+        strcat(bb_name, Interner::name(ident));
+        strcat(bb_name, "_");
+        strcat(bb_name, bb->name + 1);
+        bb->name = bb_name;
+        raw_function->bbs.buffer[i] = bb;
+    }
+    current_func.clear();
+
+    ConstPool::reset();
     Symbol::leave_scope();
 
     return raw_function;
@@ -754,7 +737,7 @@ void *FuncDefAST::toRaw(int n = 0, void* args[] = nullptr) const
 
 void *FuncFParamAST::toRaw(int n = 0, void* args[] = nullptr) const
 {
-    auto f_param = new koopa_raw_value_data_t({
+    auto f_param = ir_arena.make<koopa_raw_value_data_t>({
         .name = build_ident(ident, '@'),
         .used_by = {
             .buffer = nullptr,
@@ -772,52 +755,19 @@ void *FuncFParamAST::toRaw(int n = 0, void* args[] = nullptr) const
     });
 
     if (!is_array) {
-        f_param->ty = new koopa_raw_type_kind_t({
-            .tag = KOOPA_RTT_INT32,
-        });
+        f_param->ty = RawType::i32();
     }
     else {
         if (dim_list == nullptr) {
-            f_param->ty = new koopa_raw_type_kind_t({
-                .tag = KOOPA_RTT_POINTER,
-                .data = {
-                    .pointer = {
-                        .base = new koopa_raw_type_kind_t({
-                            .tag = KOOPA_RTT_INT32,
-                        }),
-                    },
-                },
-            });
+            f_param->ty = RawType::pointer(RawType::i32());
         }
         else {
-            auto dim_vec = new std::vector<int>();
+            std::vector<int> dim_vec;
             for (auto i = dim_list->rbegin(); i != dim_list->rend(); i++) {
                 auto dim = (long)(*i)->toRaw();
-                dim_vec->push_back(dim);
+                dim_vec.push_back(dim);
             }
-            auto temp_ty = new koopa_raw_type_kind_t({
-                .tag = KOOPA_RTT_INT32,
-            });
-            for (auto i : *dim_vec) {
-                auto ty_array = new koopa_raw_type_kind_t({
-                    .tag = KOOPA_RTT_ARRAY,
-                    .data = {
-                        .array = {
-                            .base = temp_ty,
-                            .len = (unsigned long)i,
-                        },
-                    },
-                });
-                temp_ty = ty_array;
-            }
-            f_param->ty = new koopa_raw_type_kind_t({
-                .tag = KOOPA_RTT_POINTER,
-                .data = {
-                    .pointer = {
-                        .base = temp_ty,
-                    },
-                },
-            });
+            f_param->ty = RawType::pointer(build_type_from_dim_vec(&dim_vec));
         }
     }
 
@@ -826,7 +776,7 @@ void *FuncFParamAST::toRaw(int n = 0, void* args[] = nullptr) const
 
 void *BlockAST::toRaw(int n = 0, void* args[] = nullptr) const
 {
-    auto basic_block = new koopa_raw_basic_block_data_t;
+    auto basic_block = ir_arena.make<koopa_raw_basic_block_data_t>();
     if (n == -1) {
         basic_block->name = "%entry";
         n = 0;
@@ -1009,10 +959,8 @@ void *SimpleStmtAST::toRaw(int n = 0, void* args[] = nullptr) const
         }
         case RETURN:
         {
-            auto raw_return = new koopa_raw_value_data_t({
-                .ty = new koopa_raw_type_kind_t({
-                    .tag = KOOPA_RTT_INT32
-                }),
+            auto raw_return = ir_arena.make<koopa_raw_value_data_t>({
+                .ty = RawType::i32(),
                 .name = nullptr,
                 .used_by = {
                     .buffer = nullptr,
@@ -1033,10 +981,8 @@ void *SimpleStmtAST::toRaw(int n = 0, void* args[] = nullptr) const
         }
         case EMPTY_RETURN:
         {
-            auto raw_return = new koopa_raw_value_data_t({
-                .ty = new koopa_raw_type_kind_t({
-                    .tag = KOOPA_RTT_UNIT
-                }),
+            auto raw_return = ir_arena.make<koopa_raw_value_data_t>({
+                .ty = RawType::unit(),
                 .name = nullptr,
                 .used_by = {
                     .buffer = nullptr,
@@ -1074,7 +1020,8 @@ void *SimpleStmtAST::toRaw(int n = 0, void* args[] = nullptr) const
         case BREAK:
         {
             koopa_raw_basic_block_data_t* target = Symbol::get_loop_exit();
-            assert(target != nullptr);
+            if (target == nullptr)
+                throw CompileError("break statement not within a loop");
             auto raw_jmp = build_jump(target);
             append_value(raw_jmp);
             return nullptr;
@@ -1082,7 +1029,8 @@ void *SimpleStmtAST::toRaw(int n = 0, void* args[] = nullptr) const
         case CONTINUE:
         {
             koopa_raw_basic_block_data_t* target = Symbol::get_loop_header();
-            assert(target != nullptr);
+            if (target == nullptr)
+                throw CompileError("continue statement not within a loop");
             auto raw_jmp = build_jump(target);
             append_value(raw_jmp);
             return nullptr;
@@ -1095,7 +1043,8 @@ void *SimpleStmtAST::toRaw(int n = 0, void* args[] = nullptr) const
 void *ConstExpAST::toRaw(int n = 0, void* args[] = nullptr) const
 {
     auto value = (koopa_raw_value_data_t*)exp->toRaw();
-    assert(value->kind.tag == KOOPA_RVT_INTEGER);
+    if (value->kind.tag != KOOPA_RVT_INTEGER)
+        throw CompileError("expression is not a constant");
     int val = value->kind.data.integer.value;
     return (void*)val;
 }
@@ -1126,7 +1075,7 @@ void *PrimaryExpAST::toRaw(int n = 0, void* args[] = nullptr) const
                     case KOOPA_RTT_POINTER:
                     case KOOPA_RTT_INT32:
                     {
-                        auto load = new koopa_raw_value_data_t({
+                        auto load = ir_arena.make<koopa_raw_value_data_t>({
                             .ty = value->ty->data.pointer.base,
                             .name = nullptr,
                             .used_by = {
@@ -1148,15 +1097,8 @@ void *PrimaryExpAST::toRaw(int n = 0, void* args[] = nullptr) const
                     }
                     case KOOPA_RTT_ARRAY:
                     {
-                        auto get_elem_ptr = new koopa_raw_value_data_t({
-                            .ty = new koopa_raw_type_kind_t({
-                                .tag = KOOPA_RTT_POINTER,
-                                .data = {
-                                    .pointer = {
-                                        .base = value->ty->data.pointer.base->data.array.base,
-                                    }
-                                }
-                            }),
+                        auto get_elem_ptr = ir_arena.make<koopa_raw_value_data_t>({
+                            .ty = RawType::pointer(value->ty->data.pointer.base->data.array.base),
                             .name = nullptr,
                             .used_by = {
                                 .buffer = nullptr,
@@ -1237,10 +1179,10 @@ void *UnaryExpAST::toRaw(int n = 0, void* args[] = nullptr) const
     }
     case FUNC_CALL:
     {
-        auto call = new koopa_raw_value_data_t({
-            .ty = new koopa_raw_type_kind_t({
-                .tag = KOOPA_RTT_INT32,
-            }),
+        if (!Symbol::exists(ident) || Symbol::query(ident).type != Symbol::TYPE_FUNCTION)
+            throw CompileError(std::string("call to undeclared function ") + Interner::name(ident));
+        auto call = ir_arena.make<koopa_raw_value_data_t>({
+            .ty = RawType::i32(),
             .name = nullptr,
             .used_by = {
                 .buffer = nullptr,
@@ -1260,16 +1202,16 @@ void *UnaryExpAST::toRaw(int n = 0, void* args[] = nullptr) const
             },
         });
 
-        auto params = new std::vector<koopa_raw_value_data_t*>();
+        std::vector<koopa_raw_value_data_t*> params;
         
         for (auto &exp : *func_r_param_list) {
             auto exp_value = (koopa_raw_value_data_t*)exp->toRaw();
-            params->push_back(exp_value);
+            params.push_back(exp_value);
         }
-        call->kind.data.call.args.len = params->size();
-        call->kind.data.call.args.buffer = new const void* [params->size()];
-        for (int i = 0; i < params->size(); i++) {
-            call->kind.data.call.args.buffer[i] = params->at(i);
+        call->kind.data.call.args.len = params.size();
+        call->kind.data.call.args.buffer = ir_arena.make_array<const void*>(params.size());
+        for (int i = 0; i < params.size(); i++) {
+            call->kind.data.call.args.buffer[i] = params[i];
         }
         append_value(call);
         return call;
@@ -1378,32 +1320,25 @@ void *RelExpAST::toRaw(int n = 0, void* args[] = nullptr) const
         int left = left_value->kind.data.integer.value;
         int right = right_value->kind.data.integer.value;
         int result;
-        if (op == "<") {
-            result = left < right;
-        } else if (op == ">") {
-            result = left > right;
-        } else if (op == "<=") {
-            result = left <= right;
-        } else if (op == ">=") {
-            result = left >= right;
-        } else {
-            assert(false);
+        switch (op) {
+            case KOOPA_RBO_LT:
+                result = left < right;
+                break;
+            case KOOPA_RBO_GT:
+                result = left > right;
+                break;
+            case KOOPA_RBO_LE:
+                result = left <= right;
+                break;
+            case KOOPA_RBO_GE:
+                result = left >= right;
+                break;
+            default:
+                assert(false);
         }
         return build_number(result);
     }
-    koopa_raw_binary_op bop;
-    if (op == "<") {
-        bop = KOOPA_RBO_LT;
-    } else if (op == ">") {
-        bop = KOOPA_RBO_GT;
-    } else if (op == "<=") {
-        bop = KOOPA_RBO_LE;
-    } else if (op == ">=") {
-        bop = KOOPA_RBO_GE;
-    } else {
-        assert(false);
-    }
-    auto rel = build_binary(bop, left_value, right_value);
+    auto rel = build_binary((koopa_raw_binary_op)op, left_value, right_value);
     append_value(rel);
     return rel;
 }
@@ -1421,24 +1356,19 @@ void *EqExpAST::toRaw(int n = 0, void* args[] = nullptr) const
         int left = left_value->kind.data.integer.value;
         int right = right_value->kind.data.integer.value;
         int result;
-        if (op == "==") {
-            result = left == right;
-        } else if (op == "!=") {
-            result = left != right;
-        } else {
-            assert(false);
+        switch (op) {
+            case KOOPA_RBO_EQ:
+                result = left == right;
+                break;
+            case KOOPA_RBO_NOT_EQ:
+                result = left != right;
+                break;
+            default:
+                assert(false);
         }
         return build_number(result);
     }
-    koopa_raw_binary_op bop;
-    if (op == "==") {
-        bop = KOOPA_RBO_EQ;
-    } else if (op == "!=") {
-        bop = KOOPA_RBO_NOT_EQ;
-    } else {
-        assert(false);
-    }
-    auto eq = build_binary(bop, left_value, right_value);
+    auto eq = build_binary((koopa_raw_binary_op)op, left_value, right_value);
     append_value(eq);
     return eq;
 }
@@ -1493,10 +1423,8 @@ void *LAndExpAST::toRaw(int n = 0, void* args[] = nullptr) const
 
     // lhs不能判断值
     // end_bb
-    auto end_param = new koopa_raw_value_data_t({
-        .ty = new koopa_raw_type_kind_t({
-            .tag = KOOPA_RTT_INT32,
-        }),
+    auto end_param = ir_arena.make<koopa_raw_value_data_t>({
+        .ty = RawType::i32(),
         .name = "%value",
         .used_by = {
             .buffer = nullptr,
@@ -1513,10 +1441,10 @@ void *LAndExpAST::toRaw(int n = 0, void* args[] = nullptr) const
         },
     });
 
-    auto end_bb = new koopa_raw_basic_block_data_t({
+    auto end_bb = ir_arena.make<koopa_raw_basic_block_data_t>({
         .name = "%land_end",
         .params = {
-            .buffer = new const void* [1],
+            .buffer = ir_arena.make_array<const void*>(1),
             .len = 1,
             .kind = KOOPA_RSIK_VALUE,
         },
@@ -1534,16 +1462,16 @@ void *LAndExpAST::toRaw(int n = 0, void* args[] = nullptr) const
     end_bb->params.buffer[0] = end_param;
 
     // br
-    auto false_args = new koopa_raw_slice_t({
-        .buffer = new const void*[1],
+    koopa_raw_slice_t false_args = {
+        .buffer = ir_arena.make_array<const void*>(1),
         .len = 1,
         .kind = KOOPA_RSIK_VALUE,
-    });
-    false_args->buffer[0] = build_number(0);
+    };
+    false_args.buffer[0] = build_number(0);
 
     auto rhs_entry = build_block_from_insts(nullptr, "%rhs_entry");
 
-    auto branch = build_branch(left_value, rhs_entry, end_bb, nullptr, false_args);
+    auto branch = build_branch(left_value, rhs_entry, end_bb, nullptr, &false_args);
     append_value(branch);
 
     append_bb(rhs_entry);
@@ -1553,14 +1481,14 @@ void *LAndExpAST::toRaw(int n = 0, void* args[] = nullptr) const
     // ne rhs, 0
     auto ne = build_binary(KOOPA_RBO_NOT_EQ, right_value, build_number(0));
     // jmp
-    auto jmp_args = new koopa_raw_slice_t({
-        .buffer = new const void*[1],
+    koopa_raw_slice_t jmp_args = {
+        .buffer = ir_arena.make_array<const void*>(1),
         .len = 1,
         .kind = KOOPA_RSIK_VALUE,
-    });
-    jmp_args->buffer[0] = ne;
+    };
+    jmp_args.buffer[0] = ne;
 
-    auto jmp = build_jump(end_bb, jmp_args);
+    auto jmp = build_jump(end_bb, &jmp_args);
     
     append_value(ne);
     append_value(jmp);
@@ -1619,10 +1547,8 @@ void *LOrExpAST::toRaw(int n = 0, void* args[] = nullptr) const
 
     // lhs不能判断值
     // end_bb
-    auto end_param = new koopa_raw_value_data_t({
-        .ty = new koopa_raw_type_kind_t({
-            .tag = KOOPA_RTT_INT32,
-        }),
+    auto end_param = ir_arena.make<koopa_raw_value_data_t>({
+        .ty = RawType::i32(),
         .name = "%value",
         .used_by = {
             .buffer = nullptr,
@@ -1639,10 +1565,10 @@ void *LOrExpAST::toRaw(int n = 0, void* args[] = nullptr) const
         },
     });
 
-    auto end_bb = new koopa_raw_basic_block_data_t({
+    auto end_bb = ir_arena.make<koopa_raw_basic_block_data_t>({
         .name = "%lor_end",
         .params = {
-            .buffer = new const void* [1],
+            .buffer = ir_arena.make_array<const void*>(1),
             .len = 1,
             .kind = KOOPA_RSIK_VALUE,
         },
@@ -1660,16 +1586,16 @@ void *LOrExpAST::toRaw(int n = 0, void* args[] = nullptr) const
     end_bb->params.buffer[0] = end_param;
 
     // br
-    auto true_args = new koopa_raw_slice_t({
-        .buffer = new const void*[1],
+    koopa_raw_slice_t true_args = {
+        .buffer = ir_arena.make_array<const void*>(1),
         .len = 1,
         .kind = KOOPA_RSIK_VALUE,
-    });
-    true_args->buffer[0] = build_number(1);
+    };
+    true_args.buffer[0] = build_number(1);
 
     auto rhs_entry = build_block_from_insts(nullptr, "%rhs_entry");
 
-    auto branch = build_branch(left_value, end_bb, rhs_entry, true_args, nullptr);
+    auto branch = build_branch(left_value, end_bb, rhs_entry, &true_args, nullptr);
     append_value(branch);
 
     append_bb(rhs_entry);
@@ -1680,14 +1606,14 @@ void *LOrExpAST::toRaw(int n = 0, void* args[] = nullptr) const
     auto ne = build_binary(KOOPA_RBO_NOT_EQ, right_value, build_number(0));
 
     // jmp
-    auto jmp_args = new koopa_raw_slice_t({
-        .buffer = new const void*[1],
+    koopa_raw_slice_t jmp_args = {
+        .buffer = ir_arena.make_array<const void*>(1),
         .len = 1,
         .kind = KOOPA_RSIK_VALUE,
-    });
-    jmp_args->buffer[0] = ne;
+    };
+    jmp_args.buffer[0] = ne;
 
-    auto jmp = build_jump(end_bb, jmp_args);
+    auto jmp = build_jump(end_bb, &jmp_args);
 
     append_value(ne);
     append_value(jmp);
@@ -1730,135 +1656,72 @@ void *VarDeclAST::toRaw(int n = 0, void* args[] = nullptr) const
 
 void *ConstDefAST::toRaw(int n = 0, void* args[] = nullptr) const
 {
-    // const_init_val的toRaw()填充args[1]的result_vec
-    auto dim_vec = new std::vector<int>();
+    // const_init_val的toRaw()填充args[1]的init
+    auto dim_vec = Symbol::new_dims();
     if (dim_list != nullptr)
         for (auto i = dim_list->rbegin(); i != dim_list->rend(); i++) {
             dim_vec->push_back((long)(*i)->toRaw());
         }
-    auto result_vec = new std::vector<int>();
-    const_init_val->toRaw(n, new void*[2]{dim_vec, result_vec});
+    InitList<int> init;
+    void* init_args[2] = {dim_vec, &init};
+    const_init_val->toRaw(n, init_args);
     if (dim_list == nullptr) { // 不是数组
-        int val = result_vec->front();
+        int val = init.front(0);
         Symbol::insert(ident, Symbol::TYPE_CONST, val);
         return nullptr;
+    }
     // 以下为数组
-    } else if (n == 1) { // global def
-        auto global_alloc = new koopa_raw_value_data_t({
-            .name = build_ident(ident, '@'),
-            .used_by = {
-                .buffer = nullptr,
-                .len = 0,
-                .kind = KOOPA_RSIK_VALUE,
-            },
-            .kind = {
-                .tag = KOOPA_RVT_GLOBAL_ALLOC,
-                .data = {
-                    .global_alloc = {
-                        .init = build_aggregate(dim_vec, result_vec),
-                    },
-                },
-            },
-        });
-        auto ty_integer = new koopa_raw_type_kind_t({
-            .tag = KOOPA_RTT_INT32,
-        });
-        koopa_raw_type_kind_t* temp_ty = ty_integer;
-        for (auto i : *dim_vec) {
-            auto ty_array = new koopa_raw_type_kind_t({
-                .tag = KOOPA_RTT_ARRAY,
-                .data = {
-                    .array = {
-                        .base = temp_ty,
-                        .len = (unsigned long)i,
-                    },
-                },
-            });
-            temp_ty = ty_array;
-        }
-        global_alloc->ty = new koopa_raw_type_kind_t({
-            .tag = KOOPA_RTT_POINTER,
-            .data = {
-                .pointer = {
-                    .base = temp_ty,
-                },
-            },
-        });
-        Symbol::insert(ident, Symbol::TYPE_ARRAY, global_alloc, dim_vec);
-        global_values.push_back(global_alloc);
-        return nullptr;
-
-    } else { // local def，不能用aggregate（其实这里倒可以用，不过用了到riscv还要坐牢，先改一下吧）
-        auto alloc = new koopa_raw_value_data_t({
-            .name = build_ident(ident, '@'),
-            .used_by = {
-                .buffer = nullptr,
-                .len = 0,
-                .kind = KOOPA_RSIK_VALUE,
-            },
-            .kind = {
-                .tag = KOOPA_RVT_ALLOC,
-            },
-        });
-        auto ty_integer = new koopa_raw_type_kind_t({
-            .tag = KOOPA_RTT_INT32,
-        });
-        koopa_raw_type_kind_t* temp_ty = ty_integer;
-        for (auto i : *dim_vec) {
-            auto ty_array = new koopa_raw_type_kind_t({
-                .tag = KOOPA_RTT_ARRAY,
-                .data = {
-                    .array = {
-                        .base = temp_ty,
-                        .len = (unsigned long)i,
-                    },
-                },
-            });
-            temp_ty = ty_array;
-        }
-        alloc->ty = new koopa_raw_type_kind_t({
-            .tag = KOOPA_RTT_POINTER,
+    // 内容在编译期就知道, 记到符号表里, 常量下标的读取直接折叠成常量
+    auto elems = ir_arena.make_array<std::pair<int, int>>(init.elems.size());
+    std::copy(init.elems.begin(), init.elems.end(), elems);
+    auto const_array = ir_arena.make<ConstArray>({elems, (int)init.elems.size()});
+    // 局部的常量数组也不在栈上每次重新初始化, 和全局的一样只放一份, 后端发现它只读时放进 .rodata
+    // 不同作用域里可能有同名的局部常量数组, 用全局变量的序号区分
+    auto name = build_ident(ident, '@');
+    if (n != 1) {
+        std::string unique = std::string(name) + "_" + std::to_string(global_values.size());
+        name = ir_arena.copy_string(unique);
+    }
+    auto global_alloc = ir_arena.make<koopa_raw_value_data_t>({
+        .name = name,
+        .used_by = {
+            .buffer = nullptr,
+            .len = 0,
+            .kind = KOOPA_RSIK_VALUE,
+        },
+        .kind = {
+            .tag = KOOPA_RVT_GLOBAL_ALLOC,
             .data = {
-                .pointer = {
-                    .base = temp_ty,
+                .global_alloc = {
+                    .init = build_aggregate(dim_vec, init),
                 },
             },
-        });
-        Symbol::insert(ident, Symbol::TYPE_ARRAY, alloc, dim_vec);
-        append_value(alloc);
-        store2array(alloc, result_vec, dim_vec);
-        return nullptr;
-    }
+        },
+    });
+    global_alloc->ty = RawType::pointer(build_type_from_dim_vec(dim_vec));
+    Symbol::insert(ident, Symbol::TYPE_ARRAY, global_alloc, dim_vec, const_array);
+    global_values.push_back(global_alloc);
+    return nullptr;
 }
 
 void *VarDefAST::toRaw(int n = 0, void* args[] = nullptr) const
 {
-    auto dim_vec = new std::vector<int>();
+    auto dim_vec = Symbol::new_dims();
     if (dim_list != nullptr)
         for (auto i = dim_list->rbegin(); i != dim_list->rend(); i++) {
             dim_vec->push_back((long)(*i)->toRaw());
         }
-    auto result_vec = new std::vector<koopa_raw_value_data_t*>();
+    InitList<koopa_raw_value_data_t*> init;
+    void* init_args[2] = {dim_vec, &init};
     if (has_init_val)
-        init_val->toRaw(n, new void*[2]{dim_vec, result_vec});
+        init_val->toRaw(n, init_args);
     if (dim_list != nullptr) { // 是数组
         if (n == 1) { // global def
             koopa_raw_value_data_t* value;
             if (has_init_val)
-                value = build_aggregate(dim_vec, result_vec);
-            else value = new koopa_raw_value_data_t({
-                .ty = build_type_from_dim_vec(dim_vec),
-                .name = nullptr,
-                .used_by = {
-                    .buffer = nullptr,
-                    .len = 0,
-                    .kind = KOOPA_RSIK_VALUE,
-                },
-                .kind = {
-                    .tag = KOOPA_RVT_ZERO_INIT,
-                },
-            });
-            auto global_alloc = new koopa_raw_value_data_t({
+                value = build_aggregate(dim_vec, init);
+            else value = build_zero_init(build_type_from_dim_vec(dim_vec));
+            auto global_alloc = ir_arena.make<koopa_raw_value_data_t>({
                 .name = build_ident(ident, '@'),
                 .used_by = {
                     .buffer = nullptr,
@@ -1874,53 +1737,14 @@ void *VarDefAST::toRaw(int n = 0, void* args[] = nullptr) const
                     }
                 }
             });
-            auto ty_integer = new koopa_raw_type_kind_t({
-                .tag = KOOPA_RTT_INT32,
-            });
-            koopa_raw_type_kind_t* temp_ty = ty_integer;
-            for (auto i : *dim_vec) {
-                auto ty_array = new koopa_raw_type_kind_t({
-                    .tag = KOOPA_RTT_ARRAY,
-                    .data = {
-                        .array = {
-                            .base = temp_ty,
-                            .len = (unsigned long)i,
-                        },
-                    },
-                });
-                temp_ty = ty_array;
-            }
-            global_alloc->ty = new koopa_raw_type_kind_t({
-                .tag = KOOPA_RTT_POINTER,
-                .data = {
-                    .pointer = {
-                        .base = temp_ty,
-                    },
-                },
-            });
+            global_alloc->ty = RawType::pointer(build_type_from_dim_vec(dim_vec));
             global_values.push_back(global_alloc);
             Symbol::insert(ident, Symbol::TYPE_ARRAY, global_alloc, dim_vec);
             return nullptr;
         }
         else { // local array
-            if (!has_init_val) {
-                int len = 1;
-                for (auto i : *dim_vec) {
-                    len *= i;
-                }
-                for (int i = 0; i < len; i++) {
-                    result_vec->push_back(build_number(0));
-                }
-            }
-            auto alloc = new koopa_raw_value_data_t({
-                .ty = new koopa_raw_type_kind_t({
-                    .tag = KOOPA_RTT_POINTER,
-                    .data = {
-                        .pointer = {
-                            .base = build_type_from_dim_vec(dim_vec),
-                        },
-                    },
-                }),
+            auto alloc = ir_arena.make<koopa_raw_value_data_t>({
+                .ty = RawType::pointer(build_type_from_dim_vec(dim_vec)),
                 .name = build_ident(ident, '@'),
                 .used_by = {
                     .buffer = nullptr,
@@ -1933,24 +1757,17 @@ void *VarDefAST::toRaw(int n = 0, void* args[] = nullptr) const
             });
             Symbol::insert(ident, Symbol::TYPE_ARRAY, alloc, dim_vec);
             append_value(alloc);
-            store2array(alloc, result_vec, dim_vec);
+            // 没有初始化的局部数组, 值是未定义的, 不用写
+            if (has_init_val)
+                store2array(alloc, init, dim_vec);
             return nullptr;
         }
     }
     // 不是数组
     if (n == 1) {
         // global def
-        auto global_alloc = new koopa_raw_value_data_t({
-            .ty = new koopa_raw_type_kind_t({
-                .tag = KOOPA_RTT_POINTER,
-                .data = {
-                    .pointer = {
-                        .base = new koopa_raw_type_kind_t({
-                            .tag = KOOPA_RTT_INT32,
-                        }),
-                    },
-                },
-            }),
+        auto global_alloc = ir_arena.make<koopa_raw_value_data_t>({
+            .ty = RawType::pointer(RawType::i32()),
             .name = build_ident(ident, '@'),
             .used_by = {
                 .buffer = nullptr,
@@ -1962,13 +1779,11 @@ void *VarDefAST::toRaw(int n = 0, void* args[] = nullptr) const
             },
         });
         if (has_init_val) {
-            global_alloc->kind.data.global_alloc.init = (koopa_raw_value_data_t*)result_vec->front();
+            global_alloc->kind.data.global_alloc.init = init.front(build_number(0));
         }
         else {
-            global_alloc->kind.data.global_alloc.init = new koopa_raw_value_data_t({
-                .ty = new koopa_raw_type_kind_t({
-                    .tag = KOOPA_RTT_INT32,
-                }),
+            global_alloc->kind.data.global_alloc.init = ir_arena.make<koopa_raw_value_data_t>({
+                .ty = RawType::i32(),
                 .name = nullptr,
                 .used_by = {
                     .buffer = nullptr,
@@ -1993,7 +1808,7 @@ void *VarDefAST::toRaw(int n = 0, void* args[] = nullptr) const
 
     // store
     if (has_init_val) {
-        auto value = (koopa_raw_value_data_t*)result_vec->front();
+        auto value = init.front(build_number(0));
         auto store = build_store(value, alloc);
         append_value(store);
     }
@@ -2003,55 +1818,62 @@ void *VarDefAST::toRaw(int n = 0, void* args[] = nullptr) const
 void *ConstInitValAST::toRaw(int n = 0, void* args[] = nullptr) const
 {
     auto dim_vec = (std::vector<int>*)args[0];
-    auto result_vec = (std::vector<int>*)args[1];
+    auto init = (InitList<int>*)args[1];
     if (!is_list) {
-        result_vec->push_back((long)const_exp->toRaw());
+        init->push((long)const_exp->toRaw());
     } else {
-        int len = result_vec->size();
-        assert(!(len % dim_vec->front()));
+        int len = init->len;
+        if (dim_vec->empty() || len % dim_vec->front())
+            throw CompileError("misaligned initializer list");
         int alignment = 1;
         for (auto i : *dim_vec) {
             if (len % (alignment * i))
                 break;
             alignment *= i;
         }
-        auto new_dim_vec = new std::vector<int>(*dim_vec);
-        new_dim_vec->pop_back();
+        std::vector<int> new_dim_vec(*dim_vec);
+        new_dim_vec.pop_back();
+        void* sub_args[2] = {&new_dim_vec, init};
         for (auto& i : *const_init_val_list) {
-            i->toRaw(n, new void*[2]{new_dim_vec, result_vec});
+            i->toRaw(n, sub_args);
         }
-        for (; (result_vec->size() % alignment) || (result_vec->size() == 0) ; result_vec->push_back(0));
+        init->pad(len, alignment);
     }
-    return result_vec;
+    return init;
 }
 
 void *InitValAST::toRaw(int n = 0, void* args[] = nullptr) const
 {
     auto dim_vec = (std::vector<int>*)args[0];
-    auto result_vec = (std::vector<koopa_raw_value_data_t*>*)args[1];
+    auto init = (InitList<koopa_raw_value_data_t*>*)args[1];
     // void* -> koopa_raw_value_data_t*
     if (!is_list) {
-        result_vec->push_back((koopa_raw_value_data_t*)exp->toRaw());
+        init->push((koopa_raw_value_data_t*)exp->toRaw());
     } else {
-        int len = result_vec->size();
-        assert(!(len % dim_vec->front()));
+        int len = init->len;
+        if (dim_vec->empty() || len % dim_vec->front())
+            throw CompileError("misaligned initializer list");
         int alignment = 1;
         for (auto i : *dim_vec) {
             if (len % (alignment * i))
                 break;
             alignment *= i;
         }
-        auto new_dim_vec = new std::vector<int>(*dim_vec);
-        new_dim_vec->pop_back();
+        std::vector<int> new_dim_vec(*dim_vec);
+        new_dim_vec.pop_back();
+        void* sub_args[2] = {&new_dim_vec, init};
         for (auto& i : *init_val_list) {
-            i->toRaw(n, new void*[2]{new_dim_vec, result_vec});
+            i->toRaw(n, sub_args);
         }
-        for (; result_vec->size() % alignment || (!result_vec->size()); result_vec->push_back(build_number(0)));}
-    return result_vec;
+        init->pad(len, alignment);
+    }
+    return init;
 }
 
 void *LValAST::toRaw(int n = 0, void* args[] = nullptr) const
 {
+    if (!Symbol::exists(ident))
+        throw CompileError(std::string("undefined identifier ") + Interner::name(ident));
     auto sym = Symbol::query(ident);
     switch (sym.type)
     {
@@ -2060,7 +1882,7 @@ void *LValAST::toRaw(int n = 0, void* args[] = nullptr) const
             if (index_list == nullptr) {
                 return sym.allocator;
             }
-            auto load = new koopa_raw_value_data_t({
+            auto load = ir_arena.make<koopa_raw_value_data_t>({
                 .ty = sym.allocator->ty->data.pointer.base,
                 .name = nullptr,
                 .used_by = {
@@ -2078,7 +1900,7 @@ void *LValAST::toRaw(int n = 0, void* args[] = nullptr) const
                 },
             });
             append_value(load);
-            auto get_ptr = new koopa_raw_value_data_t({
+            auto get_ptr = ir_arena.make<koopa_raw_value_data_t>({
                 .ty = load->ty,
                 .name = nullptr,
                 .used_by = {
@@ -2100,15 +1922,8 @@ void *LValAST::toRaw(int n = 0, void* args[] = nullptr) const
             index_list->erase(index_list->begin());
             koopa_raw_value_data_t* temp_p = get_ptr;
             for (auto &i : *index_list) {
-                auto get_elem_ptr = new koopa_raw_value_data_t({
-                    .ty = new koopa_raw_type_kind_t({
-                        .tag = KOOPA_RTT_POINTER,
-                        .data = {
-                            .pointer = {
-                                .base = temp_p->ty->data.pointer.base->data.array.base,
-                            },
-                        },
-                    }),
+                auto get_elem_ptr = ir_arena.make<koopa_raw_value_data_t>({
+                    .ty = RawType::pointer(temp_p->ty->data.pointer.base->data.array.base),
                     .name = nullptr,
                     .used_by = {
                         .buffer = nullptr,
@@ -2135,17 +1950,33 @@ void *LValAST::toRaw(int n = 0, void* args[] = nullptr) const
             if (index_list == nullptr) {
                 return sym.allocator;
             }
+            std::vector<koopa_raw_value_data_t*> indices;
+            for (auto &i : *index_list)
+                indices.push_back((koopa_raw_value_data_t*)i->toRaw());
+            // 常量数组的下标都是常量时直接取出元素, 越界的照常生成访存
+            if (sym.const_array != nullptr && indices.size() == sym.dim_vec->size()) {
+                int offset = 0;
+                bool in_range = true;
+                for (size_t i = 0; i < indices.size(); i++) {
+                    int dim = sym.dim_vec->at(sym.dim_vec->size() - 1 - i);
+                    if (indices[i]->kind.tag != KOOPA_RVT_INTEGER) {
+                        in_range = false;
+                        break;
+                    }
+                    int index = indices[i]->kind.data.integer.value;
+                    if (index < 0 || index >= dim) {
+                        in_range = false;
+                        break;
+                    }
+                    offset = offset * dim + index;
+                }
+                if (in_range)
+                    return build_number(sym.const_array->at(offset));
+            }
             auto temp_p = sym.allocator;
-            for (auto &i : *index_list) {
-                auto get_elem_ptr = new koopa_raw_value_data_t({
-                    .ty = new koopa_raw_type_kind_t({
-                        .tag = KOOPA_RTT_POINTER,
-                        .data = {
-                            .pointer = {
-                                .base = temp_p->ty->data.pointer.base->data.array.base,
-                            },
-                        },
-                    }),
+            for (auto index : indices) {
+                auto get_elem_ptr = ir_arena.make<koopa_raw_value_data_t>({
+                    .ty = RawType::pointer(temp_p->ty->data.pointer.base->data.array.base),
                     .name = nullptr,
                     .used_by = {
                         .buffer = nullptr,
@@ -2157,7 +1988,7 @@ void *LValAST::toRaw(int n = 0, void* args[] = nullptr) const
                         .data = {
                             .get_elem_ptr = {
                                 .src = temp_p,
-                                .index = (koopa_raw_value_data_t*)i->toRaw(),
+                                .index = index,
                             },
                         },
                     },
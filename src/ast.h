@@ -7,6 +7,8 @@
 #include <cassert>
 #include <vector>
 #include "koopa.h"
+#include "intern.h"
+#include "initlist.h"
 
 class BaseAST;
 class CompUnitAST;
@@ -18,8 +20,11 @@ class ExpAST;
 class PrimaryExpAST;
 class UnaryExpAST;
 
+// 语法里的各种列表, 由所在的 AST 节点持有
+using ASTList = std::vector<std::unique_ptr<BaseAST>>;
+
+// 把指令追加到当前基本块; 开始一个新的基本块, 之后的指令都放进它
 void append_value(koopa_raw_value_data_t* value);
-void end_block();
 void append_bb(koopa_raw_basic_block_data_t* bb);
 
 // 所有 AST 的基类
@@ -29,33 +34,36 @@ public:
     virtual ~BaseAST() = default;
 
     virtual void* toRaw(int n = 0, void* args[] = nullptr) const = 0;
-    static koopa_raw_type_kind_t* build_type_from_dim_vec(std::vector<int>* dim_vec);
+    static koopa_raw_type_t build_type_from_dim_vec(std::vector<int>* dim_vec);
     static koopa_raw_value_data_t* build_number(int number, koopa_raw_value_data_t* user);
-    static char* build_ident(const std::string& ident, char c);
+    static char* build_ident(const char* ident, size_t len, char c);
+    static char* build_ident(ident_id ident, char c);
     // static void set_used_by(koopa_raw_value_data_t* value, koopa_raw_value_data_t* user);
     static koopa_raw_basic_block_data_t* build_block_from_insts(std::vector<koopa_raw_value_data_t*>* insts, const char* block_name);
     static koopa_raw_value_data_t* build_jump(koopa_raw_basic_block_t target, koopa_raw_slice_t* args);
-    static koopa_raw_slice_t combine_slices(koopa_raw_slice_t& s1, koopa_raw_slice_t& s2);
-    static void filter_basic_block(koopa_raw_basic_block_data_t* bb);
     static koopa_raw_value_data_t* build_branch(koopa_raw_value_data* cond, koopa_raw_basic_block_data_t* true_bb, koopa_raw_basic_block_data_t* false_bb, koopa_raw_slice_t* true_args, koopa_raw_slice_t* false_args);
     // static void append_value(koopa_raw_basic_block_data_t* bb, koopa_raw_value_data_t* value);
     static koopa_raw_value_data_t* build_alloc(const char* name);
     static koopa_raw_value_data_t* build_store(koopa_raw_value_data_t* value, koopa_raw_value_data_t* dest);
     static koopa_raw_function_data_t* build_function(const char* name, std::vector<std::string> params, std::string ret_ty);
     // static void check_init_val_depth(std::unique_ptr<BaseAST>& init_val);
-    static koopa_raw_value_data_t* build_aggregate(std::vector<int>* dim_vec, std::vector<int>* result_vec);
-    static koopa_raw_value_data_t* build_aggregate(std::vector<int>* dim_vec, std::vector<koopa_raw_value_data_t*>* result_vec);
+    // 全 0 的子数组用 zeroinit
+    static koopa_raw_value_data_t* build_aggregate(std::vector<int>* dim_vec, const InitList<int>& init);
+    static koopa_raw_value_data_t* build_aggregate(std::vector<int>* dim_vec, const InitList<koopa_raw_value_data_t*>& init);
     static koopa_raw_value_data_t* build_binary(koopa_raw_binary_op op, koopa_raw_value_data_t* lhs, koopa_raw_value_data_t* rhs);
     static koopa_raw_value_data_t* build_get_ptr(koopa_raw_value_data_t* src, koopa_raw_value_data_t* index);
     static koopa_raw_value_data_t* build_get_elem_ptr(koopa_raw_value_data_t* src, koopa_raw_value_data_t* index);
-    static void store2array(koopa_raw_value_data_t* src, std::vector<koopa_raw_value_data*>* values, std::vector<int>* dims);
-    static void store2array(koopa_raw_value_data_t* src, std::vector<int>* values, std::vector<int>* dims);
+    static koopa_raw_value_data_t* build_load(koopa_raw_value_data_t* src);
+    // 把 len 个 i32 清零, base 是 *i32, len > 0
+    static void zero_fill(koopa_raw_value_data_t* base, int len);
+    // 局部数组的初始化: 0 多的时候先清零, 再只写非 0 的元素
+    static void store2array(koopa_raw_value_data_t* src, const InitList<koopa_raw_value_data_t*>& init, std::vector<int>* dims);
 };
 
 class CompUnitAST : public BaseAST
 {
 public:
-    std::vector<std::unique_ptr<BaseAST>>* global_def_list;
+    std::unique_ptr<ASTList> global_def_list;
 
     void* toRaw(int n, void* args[]) const override;
 };
@@ -77,9 +85,9 @@ class FuncDefAST : public BaseAST
 {
 public:
     std::string func_type;
-    std::string ident;
+    ident_id ident;
     std::unique_ptr<BaseAST> block;
-    std::vector<std::unique_ptr<BaseAST>>* func_f_param_list;
+    std::unique_ptr<ASTList> func_f_param_list;
 
     void* toRaw(int n, void* args[]) const override;
 };
@@ -88,9 +96,9 @@ class FuncFParamAST : public BaseAST
 {
 public:
     std::string type;
-    std::string ident;
+    ident_id ident;
     bool is_array;
-    std::vector<std::unique_ptr<BaseAST>>* dim_list;
+    std::unique_ptr<ASTList> dim_list;
 
     void* toRaw(int n, void* args[]) const override;
 };
@@ -98,7 +106,7 @@ public:
 class BlockAST : public BaseAST
 {
 public:
-    std::vector<std::unique_ptr<BaseAST>> *block_item_list;
+    std::unique_ptr<ASTList> block_item_list;
 
     void* toRaw(int n, void* args[]) const override;
 };
@@ -229,8 +237,8 @@ public:
     std::unique_ptr<BaseAST> primary_exp;
     char unaryop;
     std::unique_ptr<BaseAST> unary_exp;
-    std::string ident;
-    std::vector<std::unique_ptr<BaseAST>>* func_r_param_list;
+    ident_id ident;
+    std::unique_ptr<ASTList> func_r_param_list;
 
     void* toRaw(int n, void* args[]) const override;
 };
@@ -274,7 +282,7 @@ public:
         REL
     } type;
     std::unique_ptr<BaseAST> add_exp;
-    std::string op;
+    koopa_raw_binary_op_t op;
     std::unique_ptr<BaseAST> rel_exp;
 
     void* toRaw(int n, void* args[]) const override;
@@ -289,7 +297,7 @@ public:
         EQ
     } type;
     std::unique_ptr<BaseAST> rel_exp;
-    std::string op;
+    koopa_raw_binary_op_t op;
     std::unique_ptr<BaseAST> eq_exp;
 
     void* toRaw(int n, void* args[]) const override;
@@ -341,7 +349,7 @@ class ConstDeclAST : public BaseAST
 {
 public:
     std::string btype;
-    std::vector<std::unique_ptr<BaseAST>> *const_def_list;
+    std::unique_ptr<ASTList> const_def_list;
 
     void* toRaw(int n, void* args[]) const override;
 };
@@ -350,7 +358,7 @@ class VarDeclAST : public BaseAST
 {
 public:
     std::string btype;
-    std::vector<std::unique_ptr<BaseAST>> *var_def_list;
+    std::unique_ptr<ASTList> var_def_list;
 
     void* toRaw(int n, void* args[]) const override;
 };
@@ -358,9 +366,9 @@ public:
 class ConstDefAST : public BaseAST
 {
 public:
-    std::string ident;
+    ident_id ident;
     std::unique_ptr<BaseAST> const_init_val;
-    std::vector<std::unique_ptr<BaseAST>>* dim_list;
+    std::unique_ptr<ASTList> dim_list;
 
     void* toRaw(int n, void* args[]) const override;
 };
@@ -369,9 +377,9 @@ class VarDefAST : public BaseAST
 {
 public:
     bool has_init_val;
-    std::string ident;
+    ident_id ident;
     std::unique_ptr<BaseAST> init_val;
-    std::vector<std::unique_ptr<BaseAST>>* dim_list;
+    std::unique_ptr<ASTList> dim_list;
 
     void* toRaw(int n, void* args[]) const override;
 };
@@ -381,7 +389,7 @@ class ConstInitValAST : public BaseAST
 public:
     bool is_list;
     std::unique_ptr<BaseAST> const_exp;
-    std::vector<std::unique_ptr<BaseAST>>* const_init_val_list;
+    std::unique_ptr<ASTList> const_init_val_list;
     void* toRaw(int n, void* args[]) const override;
 };
 
@@ -390,15 +398,15 @@ class InitValAST : public BaseAST
 public:
     bool is_list;
     std::unique_ptr<BaseAST> exp;
-    std::vector<std::unique_ptr<BaseAST>>* init_val_list;
+    std::unique_ptr<ASTList> init_val_list;
     void* toRaw(int n, void* args[]) const override;
 };
 
 class LValAST : public BaseAST
 {
 public:
-    std::string ident;
-    std::vector<std::unique_ptr<BaseAST>>* index_list;
+    ident_id ident;
+    std::unique_ptr<ASTList> index_list;
 
     void* toRaw(int n, void* args[]) const override;
 };
@@ -0,0 +1,109 @@
+#include "batch.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "compiler.h"
+
+namespace {
+    struct Job {
+        int line;
+        Compiler::Mode mode;
+        std::string input;
+        std::string output;
+        // 空表示成功
+        std::string error;
+    };
+
+    bool read_manifest(const char *path, std::vector<Job> &jobs)
+    {
+        std::ifstream in(path);
+        if (!in) {
+            std::cerr << path << ": cannot open manifest" << std::endl;
+            return false;
+        }
+        bool ok = true;
+        std::string text;
+        for (int line = 1; std::getline(in, text); line++) {
+            std::istringstream fields(text);
+            std::string mode, input, output, extra;
+            if (!(fields >> mode) || mode[0] == '#')
+                continue;
+            Job job{line};
+            if (!(fields >> input >> output) || (fields >> extra)) {
+                std::cerr << path << ":" << line << ": expected \"mode input output\"" << std::endl;
+                ok = false;
+                continue;
+            }
+            if (!Compiler::parse_mode(mode, job.mode)) {
+                std::cerr << path << ":" << line << ": unknown mode " << mode << std::endl;
+                ok = false;
+                continue;
+            }
+            job.input = input;
+            job.output = output;
+            jobs.push_back(std::move(job));
+        }
+        return ok;
+    }
+
+    void run_job(Compiler &compiler, Job &job)
+    {
+        std::string result;
+        try {
+            result = compiler.compile_file(job.input.c_str(), job.mode);
+        } catch (const std::exception &e) {
+            job.error = e.what();
+            return;
+        }
+        FILE *fp = fopen(job.output.c_str(), "w");
+        if (fp == nullptr) {
+            job.error = "cannot open output " + job.output;
+            return;
+        }
+        size_t written = fwrite(result.data(), 1, result.size(), fp);
+        if (fclose(fp) != 0 || written != result.size())
+            job.error = "cannot write output " + job.output;
+    }
+}
+
+int run_batch(const char *manifest, int jobs)
+{
+    std::vector<Job> queue;
+    if (!read_manifest(manifest, queue))
+        return 1;
+
+    if (jobs <= 0)
+        jobs = std::max(1u, std::thread::hardware_concurrency());
+    jobs = std::min<size_t>(jobs, std::max<size_t>(queue.size(), 1));
+
+    // 每个线程有自己的 Compiler (也就有自己的 lexer/parser 状态), 编译用到的其余状态都是线程局部的
+    std::atomic<size_t> next{0};
+    auto worker = [&]() {
+        Compiler compiler;
+        for (size_t i; (i = next.fetch_add(1)) < queue.size(); )
+            run_job(compiler, queue[i]);
+    };
+    std::vector<std::thread> threads;
+    for (int i = 1; i < jobs; i++)
+        threads.emplace_back(worker);
+    worker();
+    for (auto &thread : threads)
+        thread.join();
+
+    size_t failed = 0;
+    for (auto &job : queue) {
+        if (job.error.empty())
+            continue;
+        std::cerr << job.input << ": error: " << job.error << std::endl;
+        failed++;
+    }
+    if (failed != 0)
+        std::cerr << failed << " of " << queue.size() << " files failed" << std::endl;
+    return failed == 0 ? 0 : 1;
+}
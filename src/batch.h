@@ -0,0 +1,10 @@
+#pragma once
+
+// 批量编译: manifest 每行一个任务 "模式 输入文件 输出文件", 例如
+//     -riscv tests/a.c out/a.S
+// 空行和 # 开头的行忽略
+// jobs 个线程各自用一个 Compiler 从任务队列里取任务, jobs <= 0 时用 CPU 核数
+// 某个文件编译失败不影响其他文件, 错误信息在全部结束后按 manifest 的顺序输出到 stderr,
+// 所以不管线程怎么调度, 输出文件和错误信息都是确定的
+// 返回值: 全部成功返回 0, 否则返回 1
+int run_batch(const char *manifest, int jobs);
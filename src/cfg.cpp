@@ -0,0 +1,199 @@
+#include "cfg.h"
+#include <algorithm>
+#include <cassert>
+
+CFG::CFG(koopa_raw_function_t func, bool find_loops)
+{
+    for (uint32_t i = 0; i < func->bbs.len; i++) {
+        auto bb = (koopa_raw_basic_block_t)func->bbs.buffer[i];
+        index[bb] = (int)blocks.size();
+        blocks.push_back(bb);
+    }
+    build_edges();
+    compute_rpo();
+    compute_dominators();
+    if (find_loops)
+        compute_loops();
+    else
+        loop_depth.assign(blocks.size(), 0);
+}
+
+void CFG::build_edges()
+{
+    succs.assign(blocks.size(), {});
+    preds.assign(blocks.size(), {});
+    for (int b = 0; b < size(); b++) {
+        auto bb = blocks[b];
+        assert(bb->insts.len > 0);
+        auto term = (koopa_raw_value_t)bb->insts.buffer[bb->insts.len - 1];
+        if (term->kind.tag == KOOPA_RVT_BRANCH) {
+            succs[b].push_back(index_of(term->kind.data.branch.true_bb));
+            succs[b].push_back(index_of(term->kind.data.branch.false_bb));
+        } else if (term->kind.tag == KOOPA_RVT_JUMP) {
+            succs[b].push_back(index_of(term->kind.data.jump.target));
+        }
+        for (auto s : succs[b])
+            preds[s].push_back(b);
+    }
+}
+
+void CFG::compute_rpo()
+{
+    // 嵌套很深的程序块也很多, 不用递归
+    std::vector<bool> visited(blocks.size(), false);
+    std::vector<std::pair<int, size_t>> stack;
+    std::vector<int> postorder;
+    stack.push_back({0, 0});
+    visited[0] = true;
+    while (!stack.empty()) {
+        auto &top = stack.back();
+        if (top.second < succs[top.first].size()) {
+            int s = succs[top.first][top.second++];
+            if (!visited[s]) {
+                visited[s] = true;
+                stack.push_back({s, 0});
+            }
+        } else {
+            postorder.push_back(top.first);
+            stack.pop_back();
+        }
+    }
+    rpo.assign(postorder.rbegin(), postorder.rend());
+    rpo_number.assign(blocks.size(), -1);
+    for (int i = 0; i < (int)rpo.size(); i++)
+        rpo_number[rpo[i]] = i;
+}
+
+// Cooper, Harvey, Kennedy: A Simple, Fast Dominance Algorithm
+void CFG::compute_dominators()
+{
+    idom.assign(blocks.size(), -1);
+    auto intersect = [&](int a, int b) {
+        while (a != b) {
+            while (rpo_number[a] > rpo_number[b])
+                a = idom[a];
+            while (rpo_number[b] > rpo_number[a])
+                b = idom[b];
+        }
+        return a;
+    };
+    // 迭代时入口暂时当作自己的支配者
+    idom[0] = 0;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t i = 1; i < rpo.size(); i++) {
+            int b = rpo[i];
+            int new_idom = -1;
+            for (auto p : preds[b]) {
+                if (idom[p] == -1)
+                    continue;
+                new_idom = new_idom == -1 ? p : intersect(p, new_idom);
+            }
+            if (idom[b] != new_idom) {
+                idom[b] = new_idom;
+                changed = true;
+            }
+        }
+    }
+    idom[0] = -1;
+
+    // 支配树上的先序/后序编号, 判断支配关系只要比较区间
+    auto children = dom_children();
+    dom_pre.assign(blocks.size(), -1);
+    dom_post.assign(blocks.size(), -1);
+    int counter = 0;
+    std::vector<std::pair<int, size_t>> stack;
+    dom_pre[0] = counter++;
+    stack.push_back({0, 0});
+    while (!stack.empty()) {
+        auto &top = stack.back();
+        if (top.second < children[top.first].size()) {
+            int child = children[top.first][top.second++];
+            dom_pre[child] = counter++;
+            stack.push_back({child, 0});
+        } else {
+            dom_post[top.first] = counter++;
+            stack.pop_back();
+        }
+    }
+}
+
+bool CFG::dominates(int a, int b) const
+{
+    if (a == b)
+        return true;
+    if (!reachable(a) || !reachable(b))
+        return false;
+    return dom_pre[a] <= dom_pre[b] && dom_post[b] <= dom_post[a];
+}
+
+std::vector<std::vector<int>> CFG::dom_children() const
+{
+    std::vector<std::vector<int>> children(blocks.size());
+    for (auto b : rpo)
+        if (idom[b] != -1)
+            children[idom[b]].push_back(b);
+    return children;
+}
+
+std::vector<std::vector<int>> CFG::dominance_frontiers() const
+{
+    // 汇合点 b 在每个前驱往上到 idom(b) 之前的块的支配边界里
+    std::vector<std::vector<int>> frontiers(blocks.size());
+    for (auto b : rpo) {
+        if (preds[b].size() < 2)
+            continue;
+        for (auto p : preds[b]) {
+            if (!reachable(p))
+                continue;
+            for (int runner = p; runner != idom[b]; runner = idom[runner])
+                if (frontiers[runner].empty() || frontiers[runner].back() != b)
+                    frontiers[runner].push_back(b);
+        }
+    }
+    return frontiers;
+}
+
+void CFG::compute_loops()
+{
+    // 先按 header 收集回边 latch -> header, 一个 header 只建一个循环
+    std::vector<std::vector<int>> latches(blocks.size());
+    std::vector<int> headers;
+    for (auto b : rpo)
+        for (auto h : succs[b])
+            if (dominates(h, b)) {
+                if (latches[h].empty())
+                    headers.push_back(h);
+                latches[h].push_back(b);
+            }
+
+    loop_depth.assign(blocks.size(), 0);
+    std::vector<int> mark(blocks.size(), -1);
+    for (auto h : headers) {
+        // 从 latch 倒着走到 header 经过的块都在循环里
+        Loop loop = {h, {h}};
+        mark[h] = h;
+        std::vector<int> worklist;
+        for (auto latch : latches[h])
+            if (mark[latch] != h) {
+                mark[latch] = h;
+                loop.blocks.push_back(latch);
+                worklist.push_back(latch);
+            }
+        while (!worklist.empty()) {
+            int x = worklist.back();
+            worklist.pop_back();
+            for (auto p : preds[x]) {
+                if (!reachable(p) || mark[p] == h)
+                    continue;
+                mark[p] = h;
+                loop.blocks.push_back(p);
+                worklist.push_back(p);
+            }
+        }
+        for (auto b : loop.blocks)
+            loop_depth[b]++;
+        loops.push_back(std::move(loop));
+    }
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+#include "koopa.h"
+
+// 一个函数的控制流图, 以及建立在它上面的支配关系和循环信息
+// 基本块按 func->bbs 里的顺序编号, 0 号是入口
+// 从入口走不到的块也有编号, 但不在 rpo 里, 没有支配者, 循环深度为 0
+class CFG
+{
+public:
+    // 自然循环: 回边指向的 header 支配循环里的所有块
+    // 同一个 header 的多条回边合成一个循环
+    struct Loop {
+        int header;
+        std::vector<int> blocks;
+    };
+
+    // 循环信息在循环嵌套很深时代价和深度成平方, 用不到的 pass 可以不算
+    explicit CFG(koopa_raw_function_t func, bool find_loops = true);
+
+    int size() const { return (int)blocks.size(); }
+    int index_of(koopa_raw_basic_block_t bb) const { return index.at(bb); }
+    bool reachable(int b) const { return b == 0 || idom[b] != -1; }
+    // a 是否支配 b (块支配它自己), 两个块都必须可达
+    bool dominates(int a, int b) const;
+    // 支配树上每个块的孩子
+    std::vector<std::vector<int>> dom_children() const;
+    // 支配边界, 只包含可达的块
+    std::vector<std::vector<int>> dominance_frontiers() const;
+
+    std::vector<koopa_raw_basic_block_t> blocks;
+    std::vector<std::vector<int>> succs;
+    std::vector<std::vector<int>> preds;
+    // 可达块的逆后序
+    std::vector<int> rpo;
+    // 直接支配者, 入口和不可达的块是 -1
+    std::vector<int> idom;
+    // 不算循环时为空, loop_depth 全是 0
+    std::vector<Loop> loops;
+    // 包含这个块的自然循环的个数
+    std::vector<int> loop_depth;
+
+private:
+    std::unordered_map<koopa_raw_basic_block_t, int> index;
+    // 块在 rpo 里的位置, 不可达的块是 -1
+    std::vector<int> rpo_number;
+    // 支配树的 DFS 进入/离开编号, 不可达的块是 -1
+    std::vector<int> dom_pre;
+    std::vector<int> dom_post;
+
+    void build_edges();
+    void compute_rpo();
+    void compute_dominators();
+    void compute_loops();
+};
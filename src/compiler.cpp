@@ -0,0 +1,218 @@
+#include "compiler.h"
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include "ast.h"
+#include "visitraw.h"
+#include "rawpass.h"
+#include "opt.h"
+#include "peephole.h"
+#include "symtab.h"
+#include "constpool.h"
+#include "types.h"
+#include "intern.h"
+#include "arena.h"
+#include "sourcefile.h"
+#include "timing.h"
+#include "koopa.h"
+
+// 和 main.cpp 以前的做法一样, 不引用 flex/bison 生成的头文件, 直接声明要用的函数
+#ifndef YY_TYPEDEF_YY_SCANNER_T
+#define YY_TYPEDEF_YY_SCANNER_T
+typedef void *yyscan_t;
+#endif
+extern int yylex_init(yyscan_t *scanner);
+extern int yylex_destroy(yyscan_t scanner);
+extern int yyparse(std::unique_ptr<BaseAST> &ast, yyscan_t scanner, std::string &error);
+extern void lexer_scan_in_place(char *buf, size_t size, yyscan_t scanner);
+extern void lexer_scan_file(FILE *fp, yyscan_t scanner);
+extern void lexer_finish(yyscan_t scanner);
+
+// 清空本线程上一次编译留下的状态
+static void reset_state()
+{
+    Symbol::reset();
+    ConstPool::reset();
+    RawType::reset();
+    Interner::reset();
+    Peephole::reset();
+    asm_out.clear();
+    ir_arena.release();
+}
+
+static std::mutex koopa_mutex;
+
+// 把 Koopa 程序 dump 成字符串
+static std::string dump_program(koopa_program_t program, bool llvm)
+{
+    auto dump = llvm ? koopa_dump_llvm_to_string : koopa_dump_to_string;
+    size_t len = 0;
+    koopa_error_code_t ret = dump(program, nullptr, &len);
+    assert(ret == KOOPA_EC_SUCCESS);
+    std::string result(len + 1, '\0');
+    len = result.size();
+    ret = dump(program, &result[0], &len);
+    assert(ret == KOOPA_EC_SUCCESS);
+    result.resize(strlen(result.c_str()));
+    return result;
+}
+
+bool Compiler::parse_mode(const std::string &name, Mode &mode)
+{
+    if (name == "-koopa")
+        mode = KOOPA;
+    else if (name == "-llvm")
+        mode = LLVM;
+    else if (name == "-riscv")
+        mode = RISCV;
+    else if (name == "-perf")
+        mode = PERF;
+    else
+        return false;
+    return true;
+}
+
+Compiler::Compiler()
+{
+    int ret = yylex_init(&scanner);
+    assert(ret == 0);
+}
+
+Compiler::~Compiler()
+{
+    yylex_destroy(scanner);
+}
+
+std::string Compiler::compile(std::string_view source, Mode mode)
+{
+    // flex 要求缓冲区以两个 '\0' 结尾, 扫描时还会临时改写, 所以拷贝一份
+    std::string buffer;
+    buffer.reserve(source.size() + 2);
+    buffer.append(source);
+    buffer.append(2, '\0');
+    lexer_scan_in_place(&buffer[0], buffer.size(), scanner);
+    return run(mode);
+}
+
+std::string Compiler::compile_file(const char *path, Mode mode)
+{
+    SourceFile source;
+    if (source.map(path)) {
+        lexer_scan_in_place(source.data(), source.scan_size(), scanner);
+        return run(mode);
+    }
+    // "-" 表示标准输入
+    bool is_stdin = strcmp(path, "-") == 0;
+    FILE *fp = is_stdin ? stdin : fopen(path, "r");
+    if (fp == nullptr)
+        throw CompileError(std::string("cannot open ") + path);
+    struct Closer {
+        FILE *fp;
+        ~Closer() { if (fp != nullptr) fclose(fp); }
+    } closer{is_stdin ? nullptr : fp};
+    lexer_scan_file(fp, scanner);
+    return run(mode);
+}
+
+// 统计 IR 规模, 只在打开 -time-passes / -trace 时调用
+static void count_ir(const koopa_raw_program_t &program)
+{
+    size_t blocks = 0;
+    size_t values = program.values.len;
+    for (uint32_t i = 0; i < program.funcs.len; i++) {
+        auto func = (koopa_raw_function_t)program.funcs.buffer[i];
+        values += func->params.len;
+        blocks += func->bbs.len;
+        for (uint32_t j = 0; j < func->bbs.len; j++) {
+            auto bb = (koopa_raw_basic_block_t)func->bbs.buffer[j];
+            values += bb->insts.len;
+        }
+    }
+    Timing::set_counter("ir.functions", program.funcs.len);
+    Timing::set_counter("ir.blocks", blocks);
+    Timing::set_counter("ir.values", values);
+    Timing::set_counter("ir.types", RawType::size());
+    Timing::set_counter("ir.arena_bytes", ir_arena.bytes_allocated());
+}
+
+std::string Compiler::run(Mode mode)
+{
+    // 不管是正常结束还是抛异常, 都要释放输入缓冲和这次编译的全部状态
+    struct Cleanup {
+        yyscan_t scanner;
+        ~Cleanup()
+        {
+            lexer_finish(scanner);
+            reset_state();
+        }
+    } cleanup{scanner};
+    reset_state();
+
+    // 调用 parser 函数, parser 函数会进一步调用 lexer 解析输入
+    std::unique_ptr<BaseAST> ast;
+    std::string error;
+    {
+        Timing::Scope scope("yyparse");
+        if (yyparse(ast, scanner, error) != 0)
+            throw CompileError(error);
+    }
+
+    koopa_raw_program_t *raw_program;
+    {
+        Timing::Scope scope("CompUnitAST::toRaw");
+        raw_program = (koopa_raw_program_t*)(ast->toRaw());
+    }
+    if (Timing::enabled())
+        count_ir(*raw_program);
+
+    std::string output;
+    switch (mode) {
+        case KOOPA:
+        case LLVM:
+        {
+            // libkoopa 没有说明能不能在多个线程里同时用, 保守起见串行调用
+            std::lock_guard<std::mutex> lock(koopa_mutex);
+            koopa_program_t program;
+            {
+                Timing::Scope scope("koopa_generate_raw_to_koopa");
+                koopa_error_code_t ret = koopa_generate_raw_to_koopa(raw_program, &program);
+                assert(ret == KOOPA_EC_SUCCESS);
+            }
+            {
+                Timing::Scope scope(mode == LLVM ? "koopa_dump_llvm" : "koopa_dump");
+                output = dump_program(program, mode == LLVM);
+            }
+            koopa_delete_program(program);
+            break;
+        }
+        case RISCV:
+        case PERF:
+            // 直接处理前端生成的 raw program, 不再 dump 成字符串再 parse 回来
+            // 名字唯一化和 used_by 由 RawPass 原地补上, 然后在 raw program 上做优化
+            {
+                Timing::Scope scope("RawPass::Prepare");
+                RawPass::Prepare(*raw_program);
+            }
+            Opt::Run(*raw_program);
+            {
+                Timing::Scope scope("Visit");
+                Visit(*raw_program);
+            }
+            if (Timing::enabled())
+                Peephole::report();
+            {
+                Timing::Scope scope("asm flush");
+                asm_out.flush(output);
+            }
+            break;
+    }
+    return output;
+}
+
+std::string compile(std::string_view source, Compiler::Mode mode)
+{
+    Compiler compiler;
+    return compiler.compile(source, mode);
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+// 编译出错(语法错误, 未定义的名字, 重定义等), what() 是错误信息
+class CompileError : public std::runtime_error
+{
+public:
+    using std::runtime_error::runtime_error;
+};
+
+// 编译器的入口, 可以作为库直接在内存里编译, 不需要起进程和读写文件
+// 一次 compile 的全部状态(IR, 符号表, 驻留表, 后端的寄存器和栈信息)都是线程局部的,
+// compile 开始时清空, 结束时释放, 所以同一个进程里可以反复编译,
+// 不同线程也可以各自用自己的 Compiler 同时编译
+// 同一个 Compiler 对象不能同时在多个线程里使用
+class Compiler
+{
+public:
+    enum Mode
+    {
+        KOOPA,
+        LLVM,
+        RISCV,
+        PERF,
+    };
+
+    // 命令行参数 -koopa / -llvm / -riscv / -perf 对应的模式
+    static bool parse_mode(const std::string &name, Mode &mode);
+
+    Compiler();
+    ~Compiler();
+    Compiler(const Compiler&) = delete;
+    Compiler& operator=(const Compiler&) = delete;
+
+    // 编译 source 里的 SysY 源码, 返回生成的 Koopa IR / LLVM IR / 汇编
+    std::string compile(std::string_view source, Mode mode);
+    // 同上, 但从文件读源码. 普通文件直接映射到内存扫描, 其他的(管道等)用 stdio 读
+    std::string compile_file(const char *path, Mode mode);
+
+private:
+    void *scanner;
+
+    std::string run(Mode mode);
+};
+
+// 方便调用的版本, 每次用一个临时的 Compiler
+std::string compile(std::string_view source, Compiler::Mode mode);
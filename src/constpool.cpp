@@ -0,0 +1,55 @@
+#include "constpool.h"
+#include "arena.h"
+#include "types.h"
+#include <cstring>
+#include <unordered_map>
+
+namespace ConstPool {
+    // [SMALL_MIN, SMALL_MAX) 之间的值直接查数组, 其他的查哈希表
+    static const int SMALL_MIN = -256;
+    static const int SMALL_MAX = 1024;
+
+    static thread_local koopa_raw_value_data_t* small[SMALL_MAX - SMALL_MIN];
+    static thread_local std::unordered_map<int, koopa_raw_value_data_t*> large;
+
+    static koopa_raw_value_data_t* make_integer(int value)
+    {
+        return ir_arena.make<koopa_raw_value_data_t>({
+            .ty = RawType::i32(),
+            .name = nullptr,
+            .used_by = {
+                .buffer = nullptr,
+                .len = 0,
+                .kind = KOOPA_RSIK_VALUE,
+            },
+            .kind = {
+                .tag = KOOPA_RVT_INTEGER,
+                .data = {
+                    .integer = {
+                        .value = value,
+                    },
+                },
+            },
+        });
+    }
+
+    koopa_raw_value_data_t* get(int value)
+    {
+        if (value >= SMALL_MIN && value < SMALL_MAX) {
+            auto& slot = small[value - SMALL_MIN];
+            if (slot == nullptr)
+                slot = make_integer(value);
+            return slot;
+        }
+        auto& slot = large[value];
+        if (slot == nullptr)
+            slot = make_integer(value);
+        return slot;
+    }
+
+    void reset()
+    {
+        memset(small, 0, sizeof(small));
+        large.clear();
+    }
+}
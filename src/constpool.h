@@ -0,0 +1,15 @@
+#pragma once
+
+#include "koopa.h"
+
+// 整数常量池: 两次 reset 之间, 同一个整数值只有一个 KOOPA_RVT_INTEGER 节点
+// 常量节点可以被任意多个值, 甚至不同函数里的值共用: 前端在函数之间 reset,
+// 但优化 pass (Mem2Reg, SCCP, IVSR 等) 在前端结束之后还会取常量, 这些节点在所有函数之间共享
+// 能这样共享是因为常量节点不记录 used_by, 也从不原地修改
+// 后端按指针建的表(寄存器, 栈位置)对常量只做临时使用, 用完即释放
+namespace ConstPool {
+    koopa_raw_value_data_t* get(int value);
+
+    // 清空常量池, 之后的常量重新分配, 已经发出去的节点仍然有效 (在 ir_arena 里)
+    void reset();
+}
@@ -0,0 +1,144 @@
+#include "opt.h"
+#include "cfg.h"
+#include "rawpass.h"
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace Opt {
+    // 有副作用或者决定控制流的指令, 不管结果有没有人用都要保留
+    static bool has_side_effect(koopa_raw_value_t inst)
+    {
+        switch (inst->kind.tag) {
+            case KOOPA_RVT_STORE:
+            case KOOPA_RVT_CALL:
+            case KOOPA_RVT_RETURN:
+            case KOOPA_RVT_BRANCH:
+            case KOOPA_RVT_JUMP:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    // 先删掉从入口走不到的块, 再从有副作用的指令出发标记用到的值, 没被标记的计算和基本块参数都删掉
+    // 基本块参数只有在被用到时, 前驱传给它的实参才算被用到, 所以只在循环里互相传递的值也能删掉
+    void DeadCodeElim(koopa_raw_function_t func)
+    {
+        CFG cfg(func, false);
+        int n = cfg.size();
+
+        struct ParamInfo {
+            int block;
+            int index;
+        };
+        std::unordered_map<koopa_raw_value_t, ParamInfo> param_info;
+        for (int b = 0; b < n; b++) {
+            auto bb = cfg.blocks[b];
+            for (uint32_t i = 0; i < bb->params.len; i++)
+                param_info[(koopa_raw_value_t)bb->params.buffer[i]] = {b, (int)i};
+        }
+
+        std::unordered_set<koopa_raw_value_t> live;
+        std::vector<koopa_raw_value_t> worklist;
+        auto mark = [&](koopa_raw_value_t value) {
+            switch (value->kind.tag) {
+                case KOOPA_RVT_INTEGER:
+                case KOOPA_RVT_ZERO_INIT:
+                case KOOPA_RVT_UNDEF:
+                case KOOPA_RVT_AGGREGATE:
+                case KOOPA_RVT_GLOBAL_ALLOC:
+                case KOOPA_RVT_FUNC_ARG_REF:
+                    return;
+                default:
+                    break;
+            }
+            if (live.insert(value).second)
+                worklist.push_back(value);
+        };
+        for (auto b : cfg.rpo) {
+            auto bb = cfg.blocks[b];
+            for (uint32_t i = 0; i < bb->insts.len; i++) {
+                auto inst = (koopa_raw_value_t)bb->insts.buffer[i];
+                if (has_side_effect(inst))
+                    mark(inst);
+            }
+        }
+        while (!worklist.empty()) {
+            auto value = worklist.back();
+            worklist.pop_back();
+            if (value->kind.tag == KOOPA_RVT_BLOCK_ARG_REF) {
+                // 所有可达的前驱在这条边上传的实参
+                auto info = param_info.at(value);
+                auto target = cfg.blocks[info.block];
+                for (auto p : cfg.preds[info.block]) {
+                    if (!cfg.reachable(p))
+                        continue;
+                    auto pred = cfg.blocks[p];
+                    auto term = (koopa_raw_value_t)pred->insts.buffer[pred->insts.len - 1];
+                    if (term->kind.tag == KOOPA_RVT_JUMP) {
+                        mark((koopa_raw_value_t)term->kind.data.jump.args.buffer[info.index]);
+                    } else {
+                        auto &branch = term->kind.data.branch;
+                        if (branch.true_bb == target)
+                            mark((koopa_raw_value_t)branch.true_args.buffer[info.index]);
+                        if (branch.false_bb == target)
+                            mark((koopa_raw_value_t)branch.false_args.buffer[info.index]);
+                    }
+                }
+            } else if (value->kind.tag == KOOPA_RVT_BRANCH) {
+                mark(value->kind.data.branch.cond);
+            } else if (value->kind.tag != KOOPA_RVT_JUMP) {
+                RawPass::for_each_operand(value, mark);
+            }
+        }
+
+        // 没用的参数连同各个前驱传的实参一起删掉, 剩下的参数重新编号
+        auto live_args = [&](const koopa_raw_slice_t &args, koopa_raw_basic_block_t target) {
+            std::vector<koopa_raw_value_t> result;
+            for (uint32_t i = 0; i < args.len; i++)
+                if (live.count((koopa_raw_value_t)target->params.buffer[i]))
+                    result.push_back((koopa_raw_value_t)args.buffer[i]);
+            return make_slice(result);
+        };
+        std::vector<koopa_raw_value_t> bbs;
+        for (int b = 0; b < n; b++) {
+            if (!cfg.reachable(b))
+                continue;
+            auto bb = (koopa_raw_basic_block_data_t*)cfg.blocks[b];
+            bbs.push_back((koopa_raw_value_t)bb);
+            std::vector<koopa_raw_value_t> insts;
+            for (uint32_t i = 0; i < bb->insts.len; i++) {
+                auto inst = (koopa_raw_value_data_t*)bb->insts.buffer[i];
+                if (!live.count(inst))
+                    continue;
+                auto &kind = inst->kind;
+                if (kind.tag == KOOPA_RVT_JUMP) {
+                    kind.data.jump.args = live_args(kind.data.jump.args, kind.data.jump.target);
+                } else if (kind.tag == KOOPA_RVT_BRANCH) {
+                    kind.data.branch.true_args = live_args(kind.data.branch.true_args, kind.data.branch.true_bb);
+                    kind.data.branch.false_args = live_args(kind.data.branch.false_args, kind.data.branch.false_bb);
+                }
+                insts.push_back(inst);
+            }
+            bb->insts = make_slice(insts);
+        }
+        for (int b = 0; b < n; b++) {
+            if (!cfg.reachable(b))
+                continue;
+            auto bb = (koopa_raw_basic_block_data_t*)cfg.blocks[b];
+            std::vector<koopa_raw_value_t> params;
+            for (uint32_t i = 0; i < bb->params.len; i++) {
+                auto param = (koopa_raw_value_data_t*)bb->params.buffer[i];
+                if (!live.count(param))
+                    continue;
+                param->kind.data.block_arg_ref.index = params.size();
+                params.push_back(param);
+            }
+            bb->params = make_slice(params);
+        }
+        auto func_data = (koopa_raw_function_data_t*)func;
+        func_data->bbs = make_slice(bbs);
+        func_data->bbs.kind = KOOPA_RSIK_BASIC_BLOCK;
+    }
+}
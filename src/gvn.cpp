@@ -0,0 +1,197 @@
+#include "opt.h"
+#include "cfg.h"
+#include "rawpass.h"
+#include <cstdint>
+#include <map>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace Opt {
+    // 内存的版本: 写内存时换一个新版本, 版本相同时同一个地址读出的值相同
+    // 写已知对象只换这个对象的版本; 通过参数写, 或者调用函数, 所有地址逃逸过的对象都要换版本
+    // 从参数读的值不知道和谁重叠, 用任意一次写都会变的 any
+    // 地址没有逃逸的局部数组只会被直接写, 只在块入口重置的时候跟着 base 换
+    struct MemoryState {
+        int base = 0;
+        int all = 0;
+        int any = 0;
+        std::unordered_map<koopa_raw_value_t, int> roots;
+    };
+
+    using Key = std::vector<int64_t>;
+
+    static void add_operand(Key &key, koopa_raw_value_t value)
+    {
+        // 常量池可能有同一个整数的多个节点, 按值比较
+        if (value->kind.tag == KOOPA_RVT_INTEGER) {
+            key.push_back(0);
+            key.push_back(value->kind.data.integer.value);
+        } else {
+            key.push_back(1);
+            key.push_back((int64_t)(intptr_t)value);
+        }
+    }
+
+    static Key binary_key(koopa_raw_value_t inst)
+    {
+        auto op = inst->kind.data.binary.op;
+        auto lhs = inst->kind.data.binary.lhs, rhs = inst->kind.data.binary.rhs;
+        // a > b 和 b < a 是同一个值
+        if (op == KOOPA_RBO_GT || op == KOOPA_RBO_GE) {
+            op = op == KOOPA_RBO_GT ? KOOPA_RBO_LT : KOOPA_RBO_LE;
+            std::swap(lhs, rhs);
+        }
+        Key left = {}, right = {};
+        add_operand(left, lhs);
+        add_operand(right, rhs);
+        switch (op) {
+            case KOOPA_RBO_ADD:
+            case KOOPA_RBO_MUL:
+            case KOOPA_RBO_AND:
+            case KOOPA_RBO_OR:
+            case KOOPA_RBO_XOR:
+            case KOOPA_RBO_EQ:
+            case KOOPA_RBO_NOT_EQ:
+                if (right < left)
+                    std::swap(left, right);
+                break;
+            default:
+                break;
+        }
+        Key key = {KOOPA_RVT_BINARY, op};
+        key.insert(key.end(), left.begin(), left.end());
+        key.insert(key.end(), right.begin(), right.end());
+        return key;
+    }
+
+    // 沿支配树先序访问, 支配者里算过的值在被支配的块里直接复用 (Briggs, Cooper, Simpson 的 dominator-based value numbering)
+    // 合并等价的二元运算和地址计算, 以及中间没有被 store/call 改写的 load, store 之后的 load 直接用存进去的值
+    // 内存状态只从唯一的前驱 (也就是支配者) 继承, 有多个前驱的块从新的版本开始
+    void GVN(koopa_raw_function_t func)
+    {
+        CFG cfg(func, false);
+        int n = cfg.size();
+
+        auto escaped = escaped_allocs(func);
+        std::map<Key, koopa_raw_value_t> available;
+        std::unordered_map<koopa_raw_value_t, koopa_raw_value_t> replaced;
+        std::vector<MemoryState> exit_state(n);
+        int version = 0;
+
+        auto load_key = [&](koopa_raw_value_t ptr, const MemoryState &memory) {
+            Key key = {KOOPA_RVT_LOAD};
+            add_operand(key, ptr);
+            auto root = root_of(ptr);
+            if (root == nullptr) {
+                key.push_back(memory.all);
+                key.push_back(memory.any);
+                return key;
+            }
+            bool local = root->kind.tag == KOOPA_RVT_ALLOC && !escaped.count(root);
+            key.push_back(local ? memory.base : memory.all);
+            auto it = memory.roots.find(root);
+            key.push_back(it == memory.roots.end() ? 0 : it->second);
+            return key;
+        };
+
+        // 处理一个块, 返回新加入的表项
+        auto number = [&](int b) {
+            auto bb = (koopa_raw_basic_block_data_t*)cfg.blocks[b];
+            MemoryState memory;
+            if (b != 0 && cfg.preds[b].size() == 1) {
+                memory = exit_state[cfg.preds[b][0]];
+            } else {
+                memory.base = memory.all = memory.any = ++version;
+            }
+            std::vector<Key> inserted;
+            std::vector<koopa_raw_value_t> insts;
+            for (uint32_t i = 0; i < bb->insts.len; i++) {
+                auto inst = (koopa_raw_value_data_t*)bb->insts.buffer[i];
+                RawPass::for_each_operand_ref(inst, [&](koopa_raw_value_t &operand) {
+                    auto it = replaced.find(operand);
+                    if (it != replaced.end())
+                        operand = it->second;
+                });
+                auto &kind = inst->kind;
+                Key key;
+                switch (kind.tag) {
+                    case KOOPA_RVT_BINARY:
+                        key = binary_key(inst);
+                        break;
+                    case KOOPA_RVT_GET_ELEM_PTR:
+                        key = {KOOPA_RVT_GET_ELEM_PTR};
+                        add_operand(key, kind.data.get_elem_ptr.src);
+                        add_operand(key, kind.data.get_elem_ptr.index);
+                        break;
+                    case KOOPA_RVT_GET_PTR:
+                        key = {KOOPA_RVT_GET_PTR};
+                        add_operand(key, kind.data.get_ptr.src);
+                        add_operand(key, kind.data.get_ptr.index);
+                        break;
+                    case KOOPA_RVT_LOAD:
+                        key = load_key(kind.data.load.src, memory);
+                        break;
+                    case KOOPA_RVT_STORE: {
+                        auto root = root_of(kind.data.store.dest);
+                        memory.any = ++version;
+                        if (root == nullptr)
+                            memory.all = version;
+                        else
+                            memory.roots[root] = version;
+                        // 之后在同一个版本下读这个地址, 读到的就是刚存进去的值
+                        auto forward = load_key(kind.data.store.dest, memory);
+                        if (available.emplace(forward, kind.data.store.value).second)
+                            inserted.push_back(forward);
+                        break;
+                    }
+                    case KOOPA_RVT_CALL:
+                        memory.all = memory.any = ++version;
+                        break;
+                    default:
+                        break;
+                }
+                if (!key.empty()) {
+                    auto it = available.find(key);
+                    if (it != available.end()) {
+                        replaced[inst] = it->second;
+                        continue;
+                    }
+                    available.emplace(key, inst);
+                    inserted.push_back(key);
+                }
+                insts.push_back(inst);
+            }
+            bb->insts = make_slice(insts);
+            exit_state[b] = std::move(memory);
+            return inserted;
+        };
+        auto pop = [&](const std::vector<Key> &inserted) {
+            for (auto &key : inserted)
+                available.erase(key);
+        };
+
+        auto children = cfg.dom_children();
+        std::vector<std::vector<Key>> inserted_in(n);
+        std::vector<std::pair<int, size_t>> stack;
+        inserted_in[0] = number(0);
+        stack.push_back({0, 0});
+        while (!stack.empty()) {
+            auto &top = stack.back();
+            int b = top.first;
+            if (top.second < children[b].size()) {
+                int child = children[b][top.second++];
+                inserted_in[child] = number(child);
+                stack.push_back({child, 0});
+            } else {
+                pop(inserted_in[b]);
+                inserted_in[b] = std::vector<Key>();
+                exit_state[b] = MemoryState();
+                stack.pop_back();
+            }
+        }
+        for (int b = 0; b < n; b++)
+            if (!cfg.reachable(b))
+                pop(number(b));
+    }
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+#include "koopa.h"
+
+inline bool is_zero_elem(int value)
+{
+    return value == 0;
+}
+inline bool is_zero_elem(koopa_raw_value_data_t* value)
+{
+    return value->kind.tag == KOOPA_RVT_INTEGER && value->kind.data.integer.value == 0;
+}
+
+// 稀疏的初始化列表: 只记录不为 0 的元素和它展开后的下标(按下标递增), len 是展开后的长度
+// 数组再大, 占用的内存也只和非 0 元素的个数有关
+// T 是 int (常量初始化) 或 koopa_raw_value_data_t* (普通初始化)
+template <typename T>
+struct InitList {
+    std::vector<std::pair<int, T>> elems;
+    int len = 0;
+
+    void push(T value)
+    {
+        if (!is_zero_elem(value))
+            elems.push_back({len, value});
+        len++;
+    }
+    // 一个花括号里的元素从 start 开始, 用 0 补到 alignment 的整数倍
+    // 空的花括号也要占一个 alignment
+    void pad(int start, int alignment)
+    {
+        if (len == start || len % alignment)
+            len = (len / alignment + 1) * alignment;
+    }
+    // 第一个元素, 用于标量的初始化
+    T front(T zero) const
+    {
+        return elems.empty() || elems[0].first != 0 ? zero : elems[0].second;
+    }
+};
+
+// 常量数组的内容, 编译期读取常量下标的元素时用
+// 和 InitList<int> 一样只存非 0 元素, 放在 ir_arena 里, 生命周期为一次编译
+struct ConstArray {
+    const std::pair<int, int>* elems;
+    int count;
+
+    // 展开后第 index 个元素的值
+    int at(int index) const
+    {
+        auto end = elems + count;
+        auto it = std::lower_bound(elems, end, std::make_pair(index, 0),
+            [](const std::pair<int, int>& a, const std::pair<int, int>& b) { return a.first < b.first; });
+        return it != end && it->first == index ? it->second : 0;
+    }
+};
@@ -0,0 +1,53 @@
+#include "intern.h"
+#include "arena.h"
+#include <cstring>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace Interner {
+    // 每个线程一张表, 每次编译开始时 reset, 编号只在一次编译里有意义
+    static thread_local Arena name_arena;
+    // 键指向 name_arena 里的字符串, 不会失效
+    static thread_local std::unordered_map<std::string_view, ident_id> ids;
+    static thread_local std::vector<std::string_view> names;
+
+    ident_id intern(const char* str, size_t len)
+    {
+        auto it = ids.find(std::string_view(str, len));
+        if (it != ids.end())
+            return it->second;
+        std::string_view stored(name_arena.copy_string(str, len), len);
+        ident_id id = names.size();
+        names.push_back(stored);
+        ids.emplace(stored, id);
+        return id;
+    }
+
+    ident_id intern(const char* str)
+    {
+        return intern(str, strlen(str));
+    }
+
+    const char* name(ident_id id)
+    {
+        return names[id].data();
+    }
+
+    size_t length(ident_id id)
+    {
+        return names[id].size();
+    }
+
+    size_t size()
+    {
+        return names.size();
+    }
+
+    void reset()
+    {
+        ids.clear();
+        names.clear();
+        name_arena.release();
+    }
+}
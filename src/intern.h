@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstddef>
+
+// 标识符驻留表: 每个不同的标识符只存一份, 之后只用一个整数编号来表示
+// 编号从 0 开始连续分配, 可以直接当数组下标
+typedef int ident_id;
+
+namespace Interner {
+    ident_id intern(const char* str, size_t len);
+    ident_id intern(const char* str);
+
+    // 以 '\0' 结尾, 在下一次 reset 之前有效
+    const char* name(ident_id id);
+    size_t length(ident_id id);
+
+    // 已分配的编号个数
+    size_t size();
+
+    // 清空驻留表, 之前的编号全部作废
+    void reset();
+}
@@ -0,0 +1,377 @@
+#include "opt.h"
+#include "arena.h"
+#include "cfg.h"
+#include "constpool.h"
+#include "rawpass.h"
+#include "types.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <unordered_map>
+#include <vector>
+
+namespace Opt {
+    static koopa_raw_value_data_t* make_inst(koopa_raw_type_t ty)
+    {
+        auto inst = ir_arena.make<koopa_raw_value_data_t>();
+        inst->ty = ty;
+        inst->name = nullptr;
+        inst->used_by = {nullptr, 0, KOOPA_RSIK_VALUE};
+        return inst;
+    }
+
+    // getelemptr 或 getptr
+    static koopa_raw_value_data_t* make_address(koopa_raw_value_tag_t tag, koopa_raw_type_t ty,
+                                                koopa_raw_value_t src, koopa_raw_value_t index)
+    {
+        auto inst = make_inst(ty);
+        inst->kind.tag = tag;
+        if (tag == KOOPA_RVT_GET_ELEM_PTR)
+            inst->kind.data.get_elem_ptr = {src, index};
+        else
+            inst->kind.data.get_ptr = {src, index};
+        return inst;
+    }
+
+    static koopa_raw_value_data_t* make_get_ptr(koopa_raw_value_t src, koopa_raw_value_t index)
+    {
+        auto inst = make_inst(src->ty);
+        inst->kind.tag = KOOPA_RVT_GET_PTR;
+        inst->kind.data.get_ptr = {src, index};
+        return inst;
+    }
+
+    static void insert_after(koopa_raw_basic_block_t bb, koopa_raw_value_t anchor, koopa_raw_value_t inst)
+    {
+        std::vector<koopa_raw_value_t> insts;
+        for (uint32_t i = 0; i < bb->insts.len; i++) {
+            insts.push_back((koopa_raw_value_t)bb->insts.buffer[i]);
+            if (insts.back() == anchor)
+                insts.push_back(inst);
+        }
+        ((koopa_raw_basic_block_data_t*)bb)->insts = make_slice(insts);
+    }
+
+    static void insert_before_terminator(koopa_raw_basic_block_t bb, koopa_raw_value_t inst)
+    {
+        std::vector<koopa_raw_value_t> insts;
+        for (uint32_t i = 0; i + 1 < bb->insts.len; i++)
+            insts.push_back((koopa_raw_value_t)bb->insts.buffer[i]);
+        insts.push_back(inst);
+        insts.push_back((koopa_raw_value_t)bb->insts.buffer[bb->insts.len - 1]);
+        ((koopa_raw_basic_block_data_t*)bb)->insts = make_slice(insts);
+    }
+
+    // term 跳到 target 的那些边上的实参
+    template <typename F>
+    static void for_each_edge_args(koopa_raw_value_t term, koopa_raw_basic_block_t target, F f)
+    {
+        auto &kind = ((koopa_raw_value_data_t*)term)->kind;
+        if (kind.tag == KOOPA_RVT_JUMP) {
+            if (kind.data.jump.target == target)
+                f(kind.data.jump.args);
+        } else if (kind.tag == KOOPA_RVT_BRANCH) {
+            if (kind.data.branch.true_bb == target)
+                f(kind.data.branch.true_args);
+            if (kind.data.branch.false_bb == target)
+                f(kind.data.branch.false_args);
+        }
+    }
+
+    static koopa_raw_value_t terminator(koopa_raw_basic_block_t bb)
+    {
+        return (koopa_raw_value_t)bb->insts.buffer[bb->insts.len - 1];
+    }
+
+    // value 是不是 iv + k 或者 iv - k (k 是整数常量), 是的话求出 k
+    static bool offset_of(koopa_raw_value_t value, koopa_raw_value_t iv, int &k)
+    {
+        if (value == iv) {
+            k = 0;
+            return true;
+        }
+        if (value->kind.tag != KOOPA_RVT_BINARY)
+            return false;
+        auto &binary = value->kind.data.binary;
+        if (binary.op == KOOPA_RBO_ADD && binary.lhs == iv && binary.rhs->kind.tag == KOOPA_RVT_INTEGER) {
+            k = binary.rhs->kind.data.integer.value;
+            return true;
+        }
+        if (binary.op == KOOPA_RBO_ADD && binary.rhs == iv && binary.lhs->kind.tag == KOOPA_RVT_INTEGER) {
+            k = binary.lhs->kind.data.integer.value;
+            return true;
+        }
+        if (binary.op == KOOPA_RBO_SUB && binary.lhs == iv && binary.rhs->kind.tag == KOOPA_RVT_INTEGER
+            && binary.rhs->kind.data.integer.value != INT32_MIN) {
+            k = -binary.rhs->kind.data.integer.value;
+            return true;
+        }
+        return false;
+    }
+
+    // 循环条件 iv op n 从 init 开始每次加 step, 第一次不成立时 iv 的值; 一次都不执行或者算不出来时返回 false
+    static bool exit_value(koopa_raw_binary_op_t op, int64_t init, int64_t n, int64_t step, int64_t &exit)
+    {
+        int64_t trips;
+        switch (op) {
+            case KOOPA_RBO_LT:
+                if (step <= 0 || init >= n)
+                    return false;
+                trips = (n - init + step - 1) / step;
+                break;
+            case KOOPA_RBO_LE:
+                if (step <= 0 || init > n)
+                    return false;
+                trips = (n - init) / step + 1;
+                break;
+            case KOOPA_RBO_GT:
+                if (step >= 0 || init <= n)
+                    return false;
+                trips = (init - n - step - 1) / -step;
+                break;
+            case KOOPA_RBO_GE:
+                if (step >= 0 || init < n)
+                    return false;
+                trips = (init - n) / -step + 1;
+                break;
+            case KOOPA_RBO_NOT_EQ:
+                if (step == 0 || (n - init) % step != 0 || (n - init) / step <= 0)
+                    return false;
+                trips = (n - init) / step;
+                break;
+            default:
+                return false;
+        }
+        exit = init + trips * step;
+        return true;
+    }
+
+    // 归纳变量强度削弱: header 参数 i 从 init 开始, 每次回边传 i + c (c 是常量)
+    // 循环里 getelemptr/getptr base, i (+ k) 每次都要乘一次步长, 改成一个跟着 i 走的指针 p:
+    // 入口传 base + init, 回边传 getptr p, c, 原来的地址变成 p (或者 getptr p, k)
+    // 线性函数判断替换: 如果 i 只剩下循环条件和自增在用, init 和边界都是常量, 把条件换成 p != 出口时的地址
+    // 之后 i 和它的自增没人用了, 由 DeadCodeElim 删掉
+    void IVSR(koopa_raw_function_t func)
+    {
+        CFG cfg(func);
+        if (cfg.loops.empty())
+            return;
+        int n = cfg.size();
+
+        std::unordered_map<koopa_raw_value_t, int> block_of;
+        for (int b = 0; b < n; b++) {
+            auto bb = cfg.blocks[b];
+            for (uint32_t i = 0; i < bb->params.len; i++)
+                block_of[(koopa_raw_value_t)bb->params.buffer[i]] = b;
+            for (uint32_t i = 0; i < bb->insts.len; i++)
+                block_of[(koopa_raw_value_t)bb->insts.buffer[i]] = b;
+        }
+
+        std::vector<bool> in_loop(n, false);
+        for (auto &loop : cfg.loops) {
+            for (auto b : loop.blocks)
+                in_loop[b] = true;
+            auto header = (koopa_raw_basic_block_data_t*)cfg.blocks[loop.header];
+            int preheader = -1;
+            std::vector<int> latches;
+            for (auto p : cfg.preds[loop.header]) {
+                if (in_loop[p]) {
+                    if (std::find(latches.begin(), latches.end(), p) == latches.end())
+                        latches.push_back(p);
+                } else {
+                    preheader = preheader == -1 ? p : -2;
+                }
+            }
+            bool simple = preheader >= 0 && cfg.succs[preheader].size() == 1;
+            auto invariant = [&](koopa_raw_value_t value) {
+                auto it = block_of.find(value);
+                return it == block_of.end() || !in_loop[it->second];
+            };
+
+            std::vector<koopa_raw_value_t> new_params, entry_args, latch_args;
+            uint32_t n_params = header->params.len;
+            for (uint32_t index = 0; simple && index < n_params; index++) {
+                auto iv = (koopa_raw_value_t)header->params.buffer[index];
+                if (iv->ty->tag != KOOPA_RTT_INT32)
+                    continue;
+                koopa_raw_value_t init = nullptr;
+                for_each_edge_args(terminator(cfg.blocks[preheader]), header, [&](koopa_raw_slice_t &args) {
+                    init = (koopa_raw_value_t)args.buffer[index];
+                });
+                // 所有回边传的都是同一个 i + c
+                koopa_raw_value_t next = nullptr;
+                bool same = true;
+                for (auto latch : latches)
+                    for_each_edge_args(terminator(cfg.blocks[latch]), header, [&](koopa_raw_slice_t &args) {
+                        auto arg = (koopa_raw_value_t)args.buffer[index];
+                        if (next != nullptr && next != arg)
+                            same = false;
+                        next = arg;
+                    });
+                int step;
+                if (!same || next == nullptr || next == iv || !offset_of(next, iv, step) || step == 0
+                    || !block_of.count(next))
+                    continue;
+
+                // 循环里以 i + k 为下标, base 不变的地址计算; 同一个 base 和同一种取地址共用一个指针
+                struct Reduced {
+                    koopa_raw_value_tag_t tag;
+                    koopa_raw_type_t ty;
+                    koopa_raw_value_t base;
+                    koopa_raw_value_data_t* pointer;
+                };
+                std::vector<Reduced> reduced;
+                std::vector<koopa_raw_value_t> replaced;
+                auto pointer_for = [&](koopa_raw_value_t address, koopa_raw_value_t base) {
+                    for (auto &r : reduced)
+                        if (r.tag == address->kind.tag && r.base == base)
+                            return r.pointer;
+                    auto pointer = make_block_param(address->ty, n_params + new_params.size());
+                    block_of[pointer] = loop.header;
+                    auto start = make_address(address->kind.tag, address->ty, base, init);
+                    insert_before_terminator(cfg.blocks[preheader], start);
+                    block_of[start] = preheader;
+                    auto advance = make_get_ptr(pointer, ConstPool::get(step));
+                    insert_after(cfg.blocks[block_of.at(next)], next, advance);
+                    block_of[advance] = block_of.at(next);
+                    new_params.push_back(pointer);
+                    entry_args.push_back(start);
+                    latch_args.push_back(advance);
+                    reduced.push_back({address->kind.tag, address->ty, base, pointer});
+                    return pointer;
+                };
+                // 下标可能是 i 本身, 也可能是 i + k
+                std::vector<koopa_raw_value_t> indices = {iv};
+                for (uint32_t i = 0; i < iv->used_by.len; i++) {
+                    auto user = (koopa_raw_value_t)iv->used_by.buffer[i];
+                    int k;
+                    if (block_of.count(user) && in_loop[block_of.at(user)] && offset_of(user, iv, k))
+                        indices.push_back(user);
+                }
+                for (auto index_value : indices) {
+                    int k;
+                    offset_of(index_value, iv, k);
+                    for (uint32_t i = 0; i < index_value->used_by.len; i++) {
+                        auto user = (koopa_raw_value_data_t*)index_value->used_by.buffer[i];
+                        koopa_raw_value_t base;
+                        if (user->kind.tag == KOOPA_RVT_GET_ELEM_PTR && user->kind.data.get_elem_ptr.index == index_value)
+                            base = user->kind.data.get_elem_ptr.src;
+                        else if (user->kind.tag == KOOPA_RVT_GET_PTR && user->kind.data.get_ptr.index == index_value)
+                            base = user->kind.data.get_ptr.src;
+                        else
+                            continue;
+                        if (!block_of.count(user) || !in_loop[block_of.at(user)] || !invariant(base))
+                            continue;
+                        auto pointer = pointer_for(user, base);
+                        if (k == 0) {
+                            // 使用者直接改用指针
+                            for (uint32_t j = 0; j < user->used_by.len; j++)
+                                RawPass::for_each_operand_ref((koopa_raw_value_data_t*)user->used_by.buffer[j],
+                                    [&](koopa_raw_value_t &operand) {
+                                        if (operand == user)
+                                            operand = pointer;
+                                    });
+                        } else {
+                            user->kind.tag = KOOPA_RVT_GET_PTR;
+                            user->kind.data.get_ptr = {pointer, ConstPool::get(k)};
+                        }
+                        replaced.push_back(user);
+                    }
+                }
+                if (reduced.empty())
+                    continue;
+
+                // 线性函数判断替换
+                auto branch = (koopa_raw_value_data_t*)terminator(header);
+                if (branch->kind.tag != KOOPA_RVT_BRANCH || init->kind.tag != KOOPA_RVT_INTEGER)
+                    continue;
+                auto cond = branch->kind.data.branch.cond;
+                if (cond->kind.tag != KOOPA_RVT_BINARY || block_of.count(cond) == 0 || block_of.at(cond) != loop.header
+                    || cond->used_by.len != 1)
+                    continue;
+                auto op = cond->kind.data.binary.op;
+                auto bound = cond->kind.data.binary.rhs;
+                if (cond->kind.data.binary.rhs == iv) {
+                    bound = cond->kind.data.binary.lhs;
+                    switch (op) {
+                        case KOOPA_RBO_LT: op = KOOPA_RBO_GT; break;
+                        case KOOPA_RBO_GT: op = KOOPA_RBO_LT; break;
+                        case KOOPA_RBO_LE: op = KOOPA_RBO_GE; break;
+                        case KOOPA_RBO_GE: op = KOOPA_RBO_LE; break;
+                        default: break;
+                    }
+                } else if (cond->kind.data.binary.lhs != iv) {
+                    continue;
+                }
+                if (bound->kind.tag != KOOPA_RVT_INTEGER)
+                    continue;
+                // i 除了条件, 自增和被换掉的地址以外不能有别的用处
+                bool only = true;
+                auto used_only_by = [&](koopa_raw_value_t value, auto allowed) {
+                    for (uint32_t i = 0; i < value->used_by.len; i++)
+                        if (!allowed((koopa_raw_value_t)value->used_by.buffer[i]))
+                            return false;
+                    return true;
+                };
+                auto is_replaced = [&](koopa_raw_value_t user) {
+                    return std::find(replaced.begin(), replaced.end(), user) != replaced.end();
+                };
+                for (auto index_value : indices) {
+                    if (index_value == iv || index_value == next)
+                        continue;
+                    only = only && used_only_by(index_value, is_replaced);
+                }
+                only = only && used_only_by(iv, [&](koopa_raw_value_t user) {
+                    return user == cond || user == next || is_replaced(user)
+                        || std::find(indices.begin(), indices.end(), user) != indices.end();
+                });
+                only = only && used_only_by(next, [&](koopa_raw_value_t user) {
+                    if (is_replaced(user))
+                        return true;
+                    return std::find(latches.begin(), latches.end(), block_of.count(user) ? block_of.at(user) : -1) != latches.end()
+                        && (user->kind.tag == KOOPA_RVT_JUMP || user->kind.tag == KOOPA_RVT_BRANCH);
+                });
+                int64_t start = init->kind.data.integer.value, exit;
+                if (!only || !exit_value(op, start, bound->kind.data.integer.value, step, exit))
+                    continue;
+                // 指针只比较相等, 不用管地址的符号, 但是经过的地址范围不能绕回来
+                auto &r = reduced.front();
+                int64_t stride = 4 * (int64_t)RawType::word_count(r.ty->data.pointer.base);
+                if (std::llabs(exit - start) * stride >= ((int64_t)1 << 31) || std::llabs(exit) * stride >= ((int64_t)1 << 31))
+                    continue;
+                auto end = make_address(r.tag, r.ty, r.base, ConstPool::get((int)exit));
+                insert_before_terminator(cfg.blocks[preheader], end);
+                block_of[end] = preheader;
+                auto exit_test = make_inst(RawType::i32());
+                exit_test->kind.tag = KOOPA_RVT_BINARY;
+                exit_test->kind.data.binary = {KOOPA_RBO_NOT_EQ, r.pointer, end};
+                insert_before_terminator(header, exit_test);
+                block_of[exit_test] = loop.header;
+                branch->kind.data.branch.cond = exit_test;
+            }
+
+            // 新的 header 参数和各条入边上的实参
+            if (!new_params.empty()) {
+                std::vector<koopa_raw_value_t> params;
+                for (uint32_t i = 0; i < header->params.len; i++)
+                    params.push_back((koopa_raw_value_t)header->params.buffer[i]);
+                params.insert(params.end(), new_params.begin(), new_params.end());
+                header->params = make_slice(params);
+                auto append = [&](const std::vector<koopa_raw_value_t> &extra) {
+                    return [&](koopa_raw_slice_t &args) {
+                        std::vector<koopa_raw_value_t> values;
+                        for (uint32_t i = 0; i < args.len; i++)
+                            values.push_back((koopa_raw_value_t)args.buffer[i]);
+                        values.insert(values.end(), extra.begin(), extra.end());
+                        args = make_slice(values);
+                    };
+                };
+                for_each_edge_args(terminator(cfg.blocks[preheader]), header, append(entry_args));
+                for (auto latch : latches)
+                    for_each_edge_args(terminator(cfg.blocks[latch]), header, append(latch_args));
+            }
+            for (auto b : loop.blocks)
+                in_loop[b] = false;
+        }
+    }
+}
@@ -0,0 +1,283 @@
+#include "opt.h"
+#include "arena.h"
+#include "cfg.h"
+#include "rawpass.h"
+#include "types.h"
+#include <algorithm>
+#include <cassert>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace Opt {
+    // 给每个循环的 header 准备一个唯一的循环外前驱, 它只有一条出边, 外提的指令放在这里
+    static void insert_preheaders(koopa_raw_function_t func)
+    {
+        CFG cfg(func);
+        int n = cfg.size();
+        std::vector<koopa_raw_basic_block_t> preheader_of(n, nullptr);
+        std::vector<int> mark(n, -1);
+        for (auto &loop : cfg.loops) {
+            int h = loop.header;
+            for (auto b : loop.blocks)
+                mark[b] = h;
+            std::vector<int> outside;
+            for (auto p : cfg.preds[h])
+                if (mark[p] != h && std::find(outside.begin(), outside.end(), p) == outside.end())
+                    outside.push_back(p);
+            if (outside.size() == 1 && cfg.succs[outside[0]].size() == 1)
+                continue;
+
+            // 新块接收原来传给 header 的实参, 再原样传过去
+            auto header = cfg.blocks[h];
+            std::vector<koopa_raw_value_t> params;
+            for (uint32_t i = 0; i < header->params.len; i++)
+                params.push_back(make_block_param(((koopa_raw_value_t)header->params.buffer[i])->ty, i));
+            auto jump = ir_arena.make<koopa_raw_value_data_t>();
+            jump->ty = RawType::unit();
+            jump->name = nullptr;
+            jump->used_by = {nullptr, 0, KOOPA_RSIK_VALUE};
+            jump->kind.tag = KOOPA_RVT_JUMP;
+            jump->kind.data.jump.target = header;
+            jump->kind.data.jump.args = make_slice(params);
+            auto preheader = ir_arena.make<koopa_raw_basic_block_data_t>();
+            // 名字重复时由 Run 最后统一改名
+            preheader->name = ir_arena.copy_string(std::string(header->name) + "_preheader");
+            preheader->params = make_slice(params);
+            preheader->used_by = {nullptr, 0, KOOPA_RSIK_VALUE};
+            preheader->insts = make_slice({jump});
+
+            for (auto p : outside) {
+                auto pred = cfg.blocks[p];
+                auto term = (koopa_raw_value_data_t*)pred->insts.buffer[pred->insts.len - 1];
+                if (term->kind.tag == KOOPA_RVT_JUMP) {
+                    term->kind.data.jump.target = preheader;
+                } else {
+                    if (term->kind.data.branch.true_bb == header)
+                        term->kind.data.branch.true_bb = preheader;
+                    if (term->kind.data.branch.false_bb == header)
+                        term->kind.data.branch.false_bb = preheader;
+                }
+            }
+            preheader_of[h] = preheader;
+        }
+
+        if (std::all_of(preheader_of.begin(), preheader_of.end(), [](koopa_raw_basic_block_t bb) { return bb == nullptr; }))
+            return;
+        // 放在 header 前面, header 是入口时新块成为入口
+        std::vector<koopa_raw_value_t> bbs;
+        for (int b = 0; b < n; b++) {
+            if (preheader_of[b] != nullptr)
+                bbs.push_back((koopa_raw_value_t)preheader_of[b]);
+            bbs.push_back((koopa_raw_value_t)cfg.blocks[b]);
+        }
+        auto func_data = (koopa_raw_function_data_t*)func;
+        func_data->bbs = make_slice(bbs);
+        func_data->bbs.kind = KOOPA_RSIK_BASIC_BLOCK;
+    }
+
+    // 从这个地址读一定不会出错: 变量本身, 或者下标都是范围内常量的数组元素
+    // 循环可能一次都不执行, 外提的 load 不能访问原来不会访问的地址
+    static bool safe_to_load(koopa_raw_value_t ptr)
+    {
+        while (ptr->kind.tag == KOOPA_RVT_GET_ELEM_PTR) {
+            auto index = ptr->kind.data.get_elem_ptr.index;
+            auto src = ptr->kind.data.get_elem_ptr.src;
+            auto array = src->ty->data.pointer.base;
+            if (index->kind.tag != KOOPA_RVT_INTEGER || array->tag != KOOPA_RTT_ARRAY)
+                return false;
+            int i = index->kind.data.integer.value;
+            if (i < 0 || (size_t)i >= array->data.array.len)
+                return false;
+            ptr = src;
+        }
+        return ptr->kind.tag == KOOPA_RVT_ALLOC || ptr->kind.tag == KOOPA_RVT_GLOBAL_ALLOC;
+    }
+
+    // 一个循环里的 store 和 call, 包括内层循环的
+    struct LoopEffects {
+        bool has_call = false;
+        bool unknown_store = false;
+        std::unordered_set<koopa_raw_value_t> stored_roots;
+    };
+
+    // 循环不变量外提: 操作数都在循环外定义的无副作用计算移到 preheader
+    // 除法只在除数是非零常量时外提; load 还要求循环里没有可能改写它的 store/call, 并且地址一定能访问
+    // 每条指令只看一次: 从所在的最内层循环往外找它不变的最外层循环, 直接放进那个循环的 preheader
+    void LICM(koopa_raw_function_t func)
+    {
+        insert_preheaders(func);
+        CFG cfg(func);
+        if (cfg.loops.empty())
+            return;
+        int n = cfg.size();
+        auto escaped = escaped_allocs(func);
+
+        std::unordered_map<koopa_raw_value_t, int> block_of;
+        for (int b = 0; b < n; b++) {
+            auto bb = cfg.blocks[b];
+            for (uint32_t i = 0; i < bb->params.len; i++)
+                block_of[(koopa_raw_value_t)bb->params.buffer[i]] = b;
+            for (uint32_t i = 0; i < bb->insts.len; i++)
+                block_of[(koopa_raw_value_t)bb->insts.buffer[i]] = b;
+        }
+
+        // 循环树: 内层循环的块是外层的子集, 按大小从小到大处理, 第一个包含块 b 的就是最内层的
+        int n_loops = cfg.loops.size();
+        std::vector<int> order(n_loops);
+        for (int l = 0; l < n_loops; l++)
+            order[l] = l;
+        std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+            return cfg.loops[a].blocks.size() < cfg.loops[b].blocks.size();
+        });
+        std::vector<int> innermost(n, -1), outermost(n, -1), parent(n_loops, -1);
+        for (auto l : order) {
+            for (auto b : cfg.loops[l].blocks) {
+                if (innermost[b] == -1)
+                    innermost[b] = l;
+                else if (outermost[b] != l && parent[outermost[b]] == -1)
+                    parent[outermost[b]] = l;
+                outermost[b] = l;
+            }
+        }
+        // 循环树上的先序/后序编号, 块是否在循环里只要比较区间
+        std::vector<std::vector<int>> children(n_loops);
+        std::vector<int> roots;
+        for (auto l : order)
+            (parent[l] == -1 ? roots : children[parent[l]]).push_back(l);
+        std::vector<int> pre(n_loops), post(n_loops);
+        int counter = 0;
+        for (auto root : roots) {
+            std::vector<std::pair<int, size_t>> stack;
+            pre[root] = counter++;
+            stack.push_back({root, 0});
+            while (!stack.empty()) {
+                auto &top = stack.back();
+                if (top.second < children[top.first].size()) {
+                    int child = children[top.first][top.second++];
+                    pre[child] = counter++;
+                    stack.push_back({child, 0});
+                } else {
+                    post[top.first] = counter++;
+                    stack.pop_back();
+                }
+            }
+        }
+        auto in_loop = [&](int b, int l) {
+            int inner = innermost[b];
+            return inner != -1 && pre[l] <= pre[inner] && post[inner] <= post[l];
+        };
+
+        std::vector<int> preheader(n_loops, -1);
+        for (int l = 0; l < n_loops; l++) {
+            int h = cfg.loops[l].header;
+            for (auto p : cfg.preds[h])
+                if (!in_loop(p, l))
+                    preheader[l] = p;
+            assert(preheader[l] != -1 && cfg.succs[preheader[l]].size() == 1);
+        }
+
+        // 每个循环自己的块里的 store 和 call, 再并到外层
+        std::vector<LoopEffects> effects(n_loops);
+        for (int b = 0; b < n; b++) {
+            if (innermost[b] == -1)
+                continue;
+            auto &effect = effects[innermost[b]];
+            auto bb = cfg.blocks[b];
+            for (uint32_t i = 0; i < bb->insts.len; i++) {
+                auto inst = (koopa_raw_value_t)bb->insts.buffer[i];
+                if (inst->kind.tag == KOOPA_RVT_CALL) {
+                    effect.has_call = true;
+                } else if (inst->kind.tag == KOOPA_RVT_STORE) {
+                    auto root = root_of(inst->kind.data.store.dest);
+                    if (root == nullptr)
+                        effect.unknown_store = true;
+                    else
+                        effect.stored_roots.insert(root);
+                }
+            }
+        }
+        for (auto l : order) {
+            if (parent[l] == -1)
+                continue;
+            auto &outer = effects[parent[l]];
+            outer.has_call |= effects[l].has_call;
+            outer.unknown_store |= effects[l].unknown_store;
+            outer.stored_roots.insert(effects[l].stored_roots.begin(), effects[l].stored_roots.end());
+        }
+
+        auto clobbered = [&](koopa_raw_value_t ptr, int l) {
+            auto &effect = effects[l];
+            auto root = root_of(ptr);
+            if (root == nullptr)
+                return effect.has_call || effect.unknown_store || !effect.stored_roots.empty();
+            bool local = root->kind.tag == KOOPA_RVT_ALLOC && !escaped.count(root);
+            if (!local && (effect.has_call || effect.unknown_store))
+                return true;
+            return effect.stored_roots.count(root) > 0;
+        };
+        auto invariant = [&](koopa_raw_value_t value, int l) {
+            auto it = block_of.find(value);
+            return it == block_of.end() || !in_loop(it->second, l);
+        };
+        auto hoistable = [&](koopa_raw_value_t inst, int l) {
+            auto &kind = inst->kind;
+            switch (kind.tag) {
+                case KOOPA_RVT_BINARY: {
+                    auto op = kind.data.binary.op;
+                    auto rhs = kind.data.binary.rhs;
+                    if ((op == KOOPA_RBO_DIV || op == KOOPA_RBO_MOD)
+                        && (rhs->kind.tag != KOOPA_RVT_INTEGER || rhs->kind.data.integer.value == 0))
+                        return false;
+                    return invariant(kind.data.binary.lhs, l) && invariant(rhs, l);
+                }
+                case KOOPA_RVT_GET_ELEM_PTR:
+                    return invariant(kind.data.get_elem_ptr.src, l) && invariant(kind.data.get_elem_ptr.index, l);
+                case KOOPA_RVT_GET_PTR:
+                    return invariant(kind.data.get_ptr.src, l) && invariant(kind.data.get_ptr.index, l);
+                case KOOPA_RVT_LOAD:
+                    return invariant(kind.data.load.src, l) && safe_to_load(kind.data.load.src)
+                        && !clobbered(kind.data.load.src, l);
+                default:
+                    return false;
+            }
+        };
+
+        // 按逆后序扫描, 除了基本块参数, 值的定义都在使用之前, 操作数该去哪里已经定好了
+        std::vector<std::vector<koopa_raw_value_t>> hoisted(n);
+        for (auto b : cfg.rpo) {
+            if (innermost[b] == -1)
+                continue;
+            auto bb = (koopa_raw_basic_block_data_t*)cfg.blocks[b];
+            std::vector<koopa_raw_value_t> insts;
+            for (uint32_t i = 0; i < bb->insts.len; i++) {
+                auto inst = (koopa_raw_value_t)bb->insts.buffer[i];
+                int target = -1;
+                for (int l = innermost[b]; l != -1 && hoistable(inst, l); l = parent[l])
+                    target = l;
+                if (target == -1) {
+                    insts.push_back(inst);
+                    continue;
+                }
+                hoisted[preheader[target]].push_back(inst);
+                block_of[inst] = preheader[target];
+            }
+            if (insts.size() != bb->insts.len)
+                bb->insts = make_slice(insts);
+        }
+        // 外提的指令放在 preheader 的 jump 之前
+        for (int b = 0; b < n; b++) {
+            if (hoisted[b].empty())
+                continue;
+            auto bb = (koopa_raw_basic_block_data_t*)cfg.blocks[b];
+            std::vector<koopa_raw_value_t> insts;
+            for (uint32_t i = 0; i + 1 < bb->insts.len; i++)
+                insts.push_back((koopa_raw_value_t)bb->insts.buffer[i]);
+            insts.insert(insts.end(), hoisted[b].begin(), hoisted[b].end());
+            insts.push_back((koopa_raw_value_t)bb->insts.buffer[bb->insts.len - 1]);
+            bb->insts = make_slice(insts);
+        }
+    }
+}
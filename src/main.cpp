@@ -1,104 +1,102 @@
 #include <cassert>
 #include <cstdio>
+#include <cstdlib>
 #include <iostream>
 #include <memory>
 #include <string>
 #include <cstring>
-#include "ast.h"
+#include <vector>
+#include "batch.h"
+#include "compiler.h"
+#include "peephole.h"
+#include "timing.h"
 #include "visitraw.h"
 #include "koopa.h"
 
 // using namespace std;
 
-// 声明 lexer 的输入, 以及 parser 函数
-// 为什么不引用 sysy.tab.hpp 呢? 因为首先里面没有 yyin 的定义
-// 其次, 因为这个文件不是我们自己写的, 而是被 Bison 生成出来的
-// 你的代码编辑器/IDE 很可能找不到这个文件, 然后会给你报错 (虽然编译不会出错)
-// 看起来会很烦人, 于是干脆采用这种看起来 dirty 但实际很有效的手段
-extern FILE *yyin;
-extern int yyparse(std::unique_ptr<BaseAST> &ast);
-
 int main(int argc, const char *argv[])
 {
+	// 批量模式: compiler -batch manifest [-j 线程数]
+	if (argc >= 3 && std::string(argv[1]) == "-batch") {
+		int jobs = 0;
+		if (argc == 5 && std::string(argv[3]) == "-j")
+			jobs = atoi(argv[4]);
+		else if (argc != 3) {
+			std::cerr << "usage: " << argv[0] << " -batch manifest [-j jobs]" << std::endl;
+			return 1;
+		}
+		return run_batch(argv[2], jobs);
+	}
+
+	// 可选的统计参数可以放在任意位置, 先把它们挑出来:
+	// -time-passes 在 stderr 输出各阶段的耗时表, -trace 文件 输出 Chrome trace
+	// -peephole=规则,... 只启用这些窥孔规则 (all 或 none 表示全开或全关)
+	bool time_passes = false;
+	const char *trace = nullptr;
+	std::vector<const char*> args;
+	for (int i = 0; i < argc; i++) {
+		if (std::string(argv[i]) == "-time-passes")
+			time_passes = true;
+		else if (std::string(argv[i]) == "-trace" && i + 1 < argc)
+			trace = argv[++i];
+		else if (strncmp(argv[i], "-peephole=", 10) == 0) {
+			if (!Peephole::configure(argv[i] + 10)) {
+				std::cerr << "unknown peephole rule in " << argv[i] << std::endl;
+				return 1;
+			}
+		}
+		else
+			args.push_back(argv[i]);
+	}
+	Timing::enable(time_passes || trace != nullptr);
+
 	// 解析命令行参数. 测试脚本/评测平台要求你的编译器能接收如下参数:
 	// compiler 模式 输入文件 -o 输出文件
-	assert(argc == 5);
-	auto mode = argv[1];
-	auto input = argv[2];
-	auto output = argv[4];
-
-	// 打开输出文件, 并且指定输出流到这个文件
-	freopen(output, "w", stdout);
+	assert(args.size() == 5);
+	auto mode = args[1];
+	auto input = args[2];
+	auto output = args[4];
 
 	if (std::string(mode) == "-test") {
+		// 打开输出文件, 并且指定输出流到这个文件
+		freopen(output, "w", stdout);
 		koopa_program_t program;
 		koopa_parse_from_file(input, &program);
 		koopa_raw_program_builder_t builder = koopa_new_raw_program_builder();
 		koopa_raw_program_t raw = koopa_build_raw_program(builder, program);
 		Visit(raw);
+		asm_out.flush(stdout);
 		koopa_dump_to_stdout(program);
 		return 0;
 	}
 
-	// 打开输入文件, 并且指定 lexer 在解析的时候读取这个文件
-	yyin = fopen(input, "r");
-	assert(yyin);
-
-	// 调用 parser 函数, parser 函数会进一步调用 lexer 解析输入文件的
-	std::unique_ptr<BaseAST> ast;
-	auto retval = yyparse(ast);
-	assert(!retval);
-
-	auto raw_program = (koopa_raw_program_t*)(ast->toRaw());
-	koopa_program_t program;
-	koopa_error_code_t ret = koopa_generate_raw_to_koopa(raw_program, &program);
-	// std::cout << (int)ret << std::endl;
-	assert(ret == KOOPA_EC_SUCCESS);
-
-	if (std::string(mode) == "-koopa")
-	{
-		// 生成 Koopa IR 字符串
-		koopa_error_code_t ret = koopa_dump_to_stdout(program);
-		assert(ret == KOOPA_EC_SUCCESS);
+	Compiler::Mode compile_mode;
+	if (!Compiler::parse_mode(mode, compile_mode)) {
+		std::cerr << "unknown mode " << mode << std::endl;
+		return 1;
 	}
-	else if (std::string(mode) == "-llvm")
-	{
-		// 生成 LLVM IR 字符串
-		koopa_error_code_t ret = koopa_dump_llvm_to_stdout(program);
-		assert(ret == KOOPA_EC_SUCCESS);
+
+	std::string result;
+	try {
+		Compiler compiler;
+		result = compiler.compile_file(input, compile_mode);
+	} catch (const CompileError &e) {
+		std::cerr << input << ": error: " << e.what() << std::endl;
+		return 1;
 	}
-	else if (std::string(mode) == "-riscv" || std::string(mode) == "-perf")
-	{
-		// size_t length;
-		// koopa_dump_to_string(program, nullptr, &length);
-		// char* buffer = new char[length+1];
-		// koopa_dump_to_string(program, buffer, &length+1); // dump到字符串
-		// buffer[length] = '\0';
-		// std::clog << buffer << std::endl;
 
-		size_t length;
-		koopa_dump_to_string(program, nullptr, &length);
-		length += 1;
-		char *buffer = new char[length];
-		koopa_dump_to_string(program, buffer, &length); // dump到字符串
-		buffer[length-1] = '\0';
+	// 生成的内容都在内存里, 一次性写到输出文件
+	FILE *fp = fopen(output, "w");
+	assert(fp);
+	fwrite(result.data(), 1, result.size(), fp);
+	fclose(fp);
 
-		koopa_error_code_t ret = koopa_parse_from_string(buffer, &program);
-		assert(ret == KOOPA_EC_SUCCESS); //确保解析正确
-		// 创建一个 raw program builder, 用来构建 raw program
-		koopa_raw_program_builder_t builder = koopa_new_raw_program_builder();
-		// 将 Koopa IR 程序转换为 raw program
-		koopa_raw_program_t raw = koopa_build_raw_program(builder, program);
-		// 释放 Koopa IR 程序占用的内存
-		koopa_delete_program(program);
-
-		// 处理 raw program
-		// ...
-		Visit(raw);
-		// 处理完成, 释放 raw program builder 占用的内存
-		// 注意, raw program 中所有的指针指向的内存均为 raw program builder 的内存
-		// 所以不要在 raw program 处理完毕之前释放 builder
-		koopa_delete_raw_program_builder(builder);
+	if (time_passes)
+		Timing::print_table(stderr);
+	if (trace != nullptr && !Timing::write_trace(trace)) {
+		std::cerr << "cannot write " << trace << std::endl;
+		return 1;
 	}
 	return 0;
 }
@@ -0,0 +1,218 @@
+#include "opt.h"
+#include "cfg.h"
+#include "constpool.h"
+#include "rawpass.h"
+#include <cassert>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace Opt {
+    // 只被 load/store 直接访问的 i32 alloc, 地址没有被存起来, 传出去或者参与地址计算
+    static bool promotable(koopa_raw_value_t alloc)
+    {
+        if (alloc->ty->data.pointer.base->tag != KOOPA_RTT_INT32)
+            return false;
+        for (uint32_t i = 0; i < alloc->used_by.len; i++) {
+            auto user = (koopa_raw_value_t)alloc->used_by.buffer[i];
+            if (user->kind.tag == KOOPA_RVT_LOAD)
+                continue;
+            if (user->kind.tag == KOOPA_RVT_STORE && user->kind.data.store.dest == alloc
+                && user->kind.data.store.value != alloc)
+                continue;
+            return false;
+        }
+        return true;
+    }
+
+    // Cytron 等人的 SSA 构造: 在定义所在块的迭代支配边界上放 phi, 再沿支配树重命名
+    // Koopa 没有 phi, phi 就是汇合块新增的参数, 前驱跳转时把当时的值作为实参传过去
+    // 只在变量活跃的块放参数 (pruned SSA), 不会产生没人用的参数
+    void Mem2Reg(koopa_raw_function_t func)
+    {
+        CFG cfg(func, false);
+        int n = cfg.size();
+
+        std::unordered_map<koopa_raw_value_t, int> var_of;
+        std::vector<koopa_raw_value_t> vars;
+        for (int b = 0; b < n; b++) {
+            auto bb = cfg.blocks[b];
+            for (uint32_t i = 0; i < bb->insts.len; i++) {
+                auto inst = (koopa_raw_value_t)bb->insts.buffer[i];
+                if (inst->kind.tag == KOOPA_RVT_ALLOC && promotable(inst)) {
+                    var_of[inst] = (int)vars.size();
+                    vars.push_back(inst);
+                }
+            }
+        }
+        if (vars.empty())
+            return;
+        int n_vars = vars.size();
+        auto var_index = [&](koopa_raw_value_t ptr) {
+            auto it = var_of.find(ptr);
+            return it == var_of.end() ? -1 : it->second;
+        };
+
+        // 每个变量在哪些块里被写, 在哪些块里先读后写 (入口处的值被用到)
+        std::vector<std::vector<int>> def_blocks(n_vars), exposed_blocks(n_vars);
+        std::vector<int> stored_in(n_vars, -1), exposed_in(n_vars, -1);
+        for (int b = 0; b < n; b++) {
+            auto bb = cfg.blocks[b];
+            for (uint32_t i = 0; i < bb->insts.len; i++) {
+                auto inst = (koopa_raw_value_t)bb->insts.buffer[i];
+                if (inst->kind.tag == KOOPA_RVT_LOAD) {
+                    int v = var_index(inst->kind.data.load.src);
+                    if (v != -1 && stored_in[v] != b && exposed_in[v] != b) {
+                        exposed_in[v] = b;
+                        exposed_blocks[v].push_back(b);
+                    }
+                } else if (inst->kind.tag == KOOPA_RVT_STORE) {
+                    int v = var_index(inst->kind.data.store.dest);
+                    if (v != -1 && stored_in[v] != b) {
+                        stored_in[v] = b;
+                        def_blocks[v].push_back(b);
+                    }
+                }
+            }
+        }
+
+        // 放参数: 迭代支配边界和入口处活跃的块的交集
+        auto frontiers = cfg.dominance_frontiers();
+        std::vector<std::vector<std::pair<int, koopa_raw_value_data_t*>>> phis(n);
+        std::vector<int> def_mark(n, -1), live_mark(n, -1), idf_mark(n, -1);
+        for (int v = 0; v < n_vars; v++) {
+            for (auto b : def_blocks[v])
+                def_mark[b] = v;
+            std::vector<int> worklist;
+            for (auto b : exposed_blocks[v]) {
+                live_mark[b] = v;
+                worklist.push_back(b);
+            }
+            while (!worklist.empty()) {
+                int b = worklist.back();
+                worklist.pop_back();
+                for (auto p : cfg.preds[b])
+                    if (live_mark[p] != v && def_mark[p] != v) {
+                        live_mark[p] = v;
+                        worklist.push_back(p);
+                    }
+            }
+
+            for (auto b : def_blocks[v])
+                if (cfg.reachable(b))
+                    worklist.push_back(b);
+            while (!worklist.empty()) {
+                int b = worklist.back();
+                worklist.pop_back();
+                for (auto y : frontiers[b]) {
+                    if (idf_mark[y] == v)
+                        continue;
+                    idf_mark[y] = v;
+                    if (live_mark[y] == v) {
+                        auto bb = cfg.blocks[y];
+                        int index = bb->params.len + phis[y].size();
+                        phis[y].push_back({v, make_block_param(vars[v]->ty->data.pointer.base, index)});
+                    }
+                    if (def_mark[y] != v)
+                        worklist.push_back(y);
+                }
+            }
+        }
+
+        // 重命名: 沿支配树先序访问, 每个变量当前的值在栈顶, 没有写过的变量当作 0
+        auto zero = ConstPool::get(0);
+        std::vector<std::vector<koopa_raw_value_t>> current(n_vars);
+        std::unordered_map<koopa_raw_value_t, koopa_raw_value_t> replaced;
+        auto top = [&](int v) {
+            return current[v].empty() ? (koopa_raw_value_t)zero : current[v].back();
+        };
+        auto edge_args = [&](const koopa_raw_slice_t &args, koopa_raw_basic_block_t target) {
+            std::vector<koopa_raw_value_t> result;
+            for (uint32_t i = 0; i < args.len; i++)
+                result.push_back((koopa_raw_value_t)args.buffer[i]);
+            for (auto &phi : phis[cfg.index_of(target)])
+                result.push_back(top(phi.first));
+            return make_slice(result);
+        };
+        // 处理一个块, 返回压过栈的变量
+        auto rename = [&](int b) {
+            auto bb = (koopa_raw_basic_block_data_t*)cfg.blocks[b];
+            std::vector<int> pushed;
+            for (auto &phi : phis[b]) {
+                current[phi.first].push_back(phi.second);
+                pushed.push_back(phi.first);
+            }
+            std::vector<koopa_raw_value_t> insts;
+            for (uint32_t i = 0; i < bb->insts.len; i++) {
+                auto inst = (koopa_raw_value_data_t*)bb->insts.buffer[i];
+                RawPass::for_each_operand_ref(inst, [&](koopa_raw_value_t &operand) {
+                    auto it = replaced.find(operand);
+                    if (it != replaced.end())
+                        operand = it->second;
+                });
+                auto &kind = inst->kind;
+                if (kind.tag == KOOPA_RVT_ALLOC && var_index(inst) != -1)
+                    continue;
+                if (kind.tag == KOOPA_RVT_LOAD && var_index(kind.data.load.src) != -1) {
+                    replaced[inst] = top(var_index(kind.data.load.src));
+                    continue;
+                }
+                if (kind.tag == KOOPA_RVT_STORE && var_index(kind.data.store.dest) != -1) {
+                    int v = var_index(kind.data.store.dest);
+                    current[v].push_back(kind.data.store.value);
+                    pushed.push_back(v);
+                    continue;
+                }
+                if (kind.tag == KOOPA_RVT_JUMP) {
+                    kind.data.jump.args = edge_args(kind.data.jump.args, kind.data.jump.target);
+                } else if (kind.tag == KOOPA_RVT_BRANCH) {
+                    kind.data.branch.true_args = edge_args(kind.data.branch.true_args, kind.data.branch.true_bb);
+                    kind.data.branch.false_args = edge_args(kind.data.branch.false_args, kind.data.branch.false_bb);
+                }
+                insts.push_back(inst);
+            }
+            bb->insts = make_slice(insts);
+            return pushed;
+        };
+        auto pop = [&](const std::vector<int> &pushed) {
+            for (auto v : pushed)
+                current[v].pop_back();
+        };
+
+        // 支配树可能很深 (一长串顺序的块), 不用递归
+        auto children = cfg.dom_children();
+        std::vector<std::vector<int>> pushed_in(n);
+        std::vector<std::pair<int, size_t>> stack;
+        pushed_in[0] = rename(0);
+        stack.push_back({0, 0});
+        while (!stack.empty()) {
+            auto &top_entry = stack.back();
+            int b = top_entry.first;
+            if (top_entry.second < children[b].size()) {
+                int child = children[b][top_entry.second++];
+                pushed_in[child] = rename(child);
+                stack.push_back({child, 0});
+            } else {
+                pop(pushed_in[b]);
+                pushed_in[b] = std::vector<int>();
+                stack.pop_back();
+            }
+        }
+        // 不可达的块里读到的值没有意义, 当作 0
+        for (int b = 0; b < n; b++)
+            if (!cfg.reachable(b))
+                pop(rename(b));
+
+        for (int b = 0; b < n; b++) {
+            if (phis[b].empty())
+                continue;
+            auto bb = (koopa_raw_basic_block_data_t*)cfg.blocks[b];
+            std::vector<koopa_raw_value_t> params;
+            for (uint32_t i = 0; i < bb->params.len; i++)
+                params.push_back((koopa_raw_value_t)bb->params.buffer[i]);
+            for (auto &phi : phis[b])
+                params.push_back(phi.second);
+            bb->params = make_slice(params);
+        }
+    }
+}
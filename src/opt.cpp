@@ -0,0 +1,102 @@
+#include "opt.h"
+#include "arena.h"
+#include "rawpass.h"
+#include "timing.h"
+
+namespace Opt {
+    koopa_raw_slice_t make_slice(const std::vector<koopa_raw_value_t> &values)
+    {
+        auto buffer = ir_arena.make_array<const void*>(values.size());
+        for (size_t i = 0; i < values.size(); i++)
+            buffer[i] = values[i];
+        return {buffer, (uint32_t)values.size(), KOOPA_RSIK_VALUE};
+    }
+
+    koopa_raw_value_data_t* make_block_param(koopa_raw_type_t ty, int index)
+    {
+        auto param = ir_arena.make<koopa_raw_value_data_t>();
+        param->ty = ty;
+        param->name = nullptr;
+        param->used_by = {nullptr, 0, KOOPA_RSIK_VALUE};
+        param->kind.tag = KOOPA_RVT_BLOCK_ARG_REF;
+        param->kind.data.block_arg_ref.index = index;
+        return param;
+    }
+
+    koopa_raw_value_t root_of(koopa_raw_value_t ptr)
+    {
+        while (true) {
+            switch (ptr->kind.tag) {
+                case KOOPA_RVT_ALLOC:
+                case KOOPA_RVT_GLOBAL_ALLOC:
+                    return ptr;
+                case KOOPA_RVT_GET_ELEM_PTR:
+                    ptr = ptr->kind.data.get_elem_ptr.src;
+                    break;
+                case KOOPA_RVT_GET_PTR:
+                    ptr = ptr->kind.data.get_ptr.src;
+                    break;
+                default:
+                    return nullptr;
+            }
+        }
+    }
+
+    std::unordered_set<koopa_raw_value_t> escaped_allocs(koopa_raw_function_t func)
+    {
+        std::unordered_set<koopa_raw_value_t> escaped;
+        for (uint32_t i = 0; i < func->bbs.len; i++) {
+            auto bb = (koopa_raw_basic_block_t)func->bbs.buffer[i];
+            for (uint32_t j = 0; j < bb->insts.len; j++) {
+                auto inst = (koopa_raw_value_t)bb->insts.buffer[j];
+                auto escape = [&](koopa_raw_value_t value) {
+                    if (value->ty->tag != KOOPA_RTT_POINTER)
+                        return;
+                    auto root = root_of(value);
+                    if (root != nullptr && root->kind.tag == KOOPA_RVT_ALLOC)
+                        escaped.insert(root);
+                };
+                if (inst->kind.tag == KOOPA_RVT_CALL) {
+                    auto &args = inst->kind.data.call.args;
+                    for (uint32_t k = 0; k < args.len; k++)
+                        escape((koopa_raw_value_t)args.buffer[k]);
+                } else if (inst->kind.tag == KOOPA_RVT_STORE) {
+                    escape(inst->kind.data.store.value);
+                } else if (inst->kind.tag == KOOPA_RVT_JUMP || inst->kind.tag == KOOPA_RVT_BRANCH
+                           || inst->kind.tag == KOOPA_RVT_RETURN) {
+                    RawPass::for_each_operand(inst, escape);
+                }
+            }
+        }
+        return escaped;
+    }
+
+    // 对每个有函数体的函数运行 pass, 然后重建 used_by
+    template <typename F>
+    static void run_pass(koopa_raw_program_t &program, const char *name, F pass)
+    {
+        Timing::Scope scope(name);
+        for (uint32_t i = 0; i < program.funcs.len; i++) {
+            auto func = (koopa_raw_function_t)program.funcs.buffer[i];
+            if (func->bbs.len > 0)
+                pass(func);
+        }
+        RawPass::BuildUseLists(program);
+    }
+
+    void Run(koopa_raw_program_t &program)
+    {
+        run_pass(program, "Opt::Mem2Reg", Mem2Reg);
+        run_pass(program, "Opt::SCCP", SCCP);
+        // SCCP 留下的走不到的分支和没用的参数先删掉, 后面的 pass 看到的 CFG 更干净
+        run_pass(program, "Opt::DeadCodeElim (after SCCP)", DeadCodeElim);
+        run_pass(program, "Opt::LICM", LICM);
+        run_pass(program, "Opt::GVN", GVN);
+        run_pass(program, "Opt::IVSR", IVSR);
+        // 强度削弱在不同的下标上各自生成的指针运算可能是同一个值
+        run_pass(program, "Opt::GVN (after IVSR)", GVN);
+        run_pass(program, "Opt::DeadCodeElim", DeadCodeElim);
+        // 新建的基本块 (比如 preheader) 的名字可能和已有的标号重复
+        RawPass::UniquifyNames(program);
+    }
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <unordered_set>
+#include <vector>
+#include "koopa.h"
+
+// 作用在 raw program 上的优化, 在 RawPass::Prepare 之后, 后端之前运行
+// 每个 pass 开始时可以假设 used_by 是最新的, 改完之后由 Run 统一重建
+// 新建的值不需要名字, 后端只用基本块的名字做标号
+namespace Opt {
+    // 依次运行所有优化
+    void Run(koopa_raw_program_t &program);
+
+    // 把地址没有逃逸的标量 alloc 提升成 SSA 值, 汇合点的值用基本块参数传递
+    void Mem2Reg(koopa_raw_function_t func);
+    // 稀疏条件常量传播, 把常量替换进使用处, 条件是常量的分支改成 jump
+    void SCCP(koopa_raw_function_t func);
+    // 基于支配树的值编号, 合并等价的运算, 地址计算和没有被改写过的 load
+    void GVN(koopa_raw_function_t func);
+    // 给循环插入 preheader, 把循环不变的无副作用计算提到里面
+    void LICM(koopa_raw_function_t func);
+    // 循环里以归纳变量为下标的地址计算改成每次加步长的指针, 能换掉的循环条件换成比较指针
+    void IVSR(koopa_raw_function_t func);
+    // 删掉不可达的块, 以及结果没人用的无副作用指令和基本块参数
+    void DeadCodeElim(koopa_raw_function_t func);
+
+    // 工具
+    koopa_raw_slice_t make_slice(const std::vector<koopa_raw_value_t> &values);
+    // 第 index 个基本块参数
+    koopa_raw_value_data_t* make_block_param(koopa_raw_type_t ty, int index);
+    // 指针最终指向的对象: alloc 或全局变量; 从参数传进来的数组不知道指向哪里, 返回 nullptr
+    koopa_raw_value_t root_of(koopa_raw_value_t ptr);
+    // 地址 (或者由它算出的地址) 被传给函数或者存进内存的 alloc
+    std::unordered_set<koopa_raw_value_t> escaped_allocs(koopa_raw_function_t func);
+}
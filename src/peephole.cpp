@@ -0,0 +1,407 @@
+#include "peephole.h"
+#include "timing.h"
+#include <array>
+#include <charconv>
+#include <deque>
+#include <string_view>
+#include <vector>
+
+namespace Peephole {
+    enum Rule {
+        SELF_MOVE,  // mv x, x 直接删掉
+        MOVE_BACK,  // mv x, y; mv y, x 删掉第二条
+        MOVE_FOLD,  // li t, 1; mv d, t => li d, 1, t 之后没用时
+        STORE_LOAD, // sw r, M; lw d, M => mv d, r, 以及 lw r, M; sw r, M 删掉 sw
+        LI_ZERO,    // li t, 0; add d, a, t => add d, a, zero
+        LI_IMM,     // li t, 1; add d, a, t => addi d, a, 1
+        JUMP_NEXT,  // 跳到紧跟着的标号的 j
+        RULE_COUNT
+    };
+
+    static const struct {
+        const char *name;
+        const char *counter;
+    } rules[RULE_COUNT] = {
+        {"self_move", "peephole.self_move"},
+        {"move_back", "peephole.move_back"},
+        {"move_fold", "peephole.move_fold"},
+        {"store_load", "peephole.store_load"},
+        {"li_zero", "peephole.li_zero"},
+        {"li_imm", "peephole.li_imm"},
+        {"jump_next", "peephole.jump_next"},
+    };
+
+    static const unsigned ALL_RULES = (1u << RULE_COUNT) - 1;
+    // 在 main 里编译开始之前设置, 批量模式的各个线程只读
+    static unsigned enabled_rules = ALL_RULES;
+    static thread_local size_t fired[RULE_COUNT];
+
+    bool configure(const std::string &spec)
+    {
+        if (spec == "all" || spec == "none") {
+            enabled_rules = spec == "all" ? ALL_RULES : 0;
+            return true;
+        }
+        unsigned mask = 0;
+        size_t pos = 0;
+        while (pos <= spec.size()) {
+            size_t comma = spec.find(',', pos);
+            if (comma == std::string::npos)
+                comma = spec.size();
+            auto name = spec.substr(pos, comma - pos);
+            int rule = 0;
+            while (rule < RULE_COUNT && name != rules[rule].name)
+                rule++;
+            if (rule == RULE_COUNT)
+                return false;
+            mask |= 1u << rule;
+            pos = comma + 1;
+        }
+        enabled_rules = mask;
+        return true;
+    }
+
+    bool enabled()
+    {
+        return enabled_rules != 0;
+    }
+
+    void report()
+    {
+        for (int rule = 0; rule < RULE_COUNT; rule++)
+            if (enabled_rules >> rule & 1)
+                Timing::set_counter(rules[rule].counter, fired[rule]);
+    }
+
+    void reset()
+    {
+        for (auto &count : fired)
+            count = 0;
+    }
+
+    // 汇编的一行, 指令的操作数指向原来的文本或者 Window::strings
+    struct Line {
+        enum Kind { INST, LABEL, BLANK, OTHER } kind;
+        std::string_view text;
+        std::string_view op;
+        std::array<std::string_view, 3> args;
+        int nargs = 0;
+        bool changed = false; // 改过的指令输出时重新拼
+        bool removed = false;
+    };
+
+    static Line parse(std::string_view text)
+    {
+        Line line;
+        line.text = text;
+        if (text.empty()) {
+            line.kind = Line::BLANK;
+            return line;
+        }
+        if (text[0] != ' ') {
+            line.kind = text.back() == ':' ? Line::LABEL : Line::OTHER;
+            return line;
+        }
+        // 后端输出的指令都是 "  op a, b, c"
+        line.kind = Line::OTHER;
+        if (text.size() < 3 || text.substr(0, 2) != "  " || text[2] == '.')
+            return line;
+        auto rest = text.substr(2);
+        auto space = rest.find(' ');
+        line.op = rest.substr(0, space);
+        if (line.op.empty())
+            return line;
+        if (space != std::string_view::npos) {
+            rest = rest.substr(space + 1);
+            while (true) {
+                if (line.nargs == (int)line.args.size())
+                    return line;
+                auto comma = rest.find(", ");
+                line.args[line.nargs++] = rest.substr(0, comma);
+                if (comma == std::string_view::npos)
+                    break;
+                rest = rest.substr(comma + 2);
+            }
+        }
+        line.kind = Line::INST;
+        return line;
+    }
+
+    // 第一个操作数是不是写的寄存器
+    static bool has_dest(const Line &line)
+    {
+        auto op = line.op;
+        if (line.nargs == 0 || op[0] == 'b')
+            return false;
+        return op != "sw" && op != "sh" && op != "sb" && op != "j" && op != "jr" && op != "call";
+    }
+
+    // 访存操作数 off(reg) 里的寄存器
+    static std::string_view base_of(std::string_view arg)
+    {
+        auto open = arg.find('(');
+        if (open == std::string_view::npos || arg.back() != ')')
+            return std::string_view();
+        return arg.substr(open + 1, arg.size() - open - 2);
+    }
+
+    static bool implicit_read(const Line &line, std::string_view reg)
+    {
+        // call 读参数寄存器, ret 读返回值
+        if (line.op == "call")
+            return reg.size() == 2 && reg[0] == 'a' && reg[1] >= '0' && reg[1] <= '7';
+        if (line.op == "ret")
+            return reg == "a0" || reg == "ra" || reg == "sp";
+        return false;
+    }
+
+    static bool reads(const Line &line, std::string_view reg)
+    {
+        for (int k = has_dest(line) ? 1 : 0; k < line.nargs; k++)
+            if (line.args[k] == reg || base_of(line.args[k]) == reg)
+                return true;
+        return implicit_read(line, reg);
+    }
+
+    static bool ends_block(const Line &line)
+    {
+        auto op = line.op;
+        return op[0] == 'b' || op == "j" || op == "jr" || op == "ret" || op == "call";
+    }
+
+    // 后端的 scratch 寄存器只在一条 IR 指令的展开里用, 不会跨过跳转, 调用和标号
+    static bool is_scratch(std::string_view reg)
+    {
+        return reg == "t4" || reg == "t5" || reg == "t6";
+    }
+
+    static bool parse_imm(std::string_view text, long &value)
+    {
+        auto result = std::from_chars(text.data(), text.data() + text.size(), value);
+        return result.ec == std::errc() && result.ptr == text.data() + text.size();
+    }
+
+    // 带立即数的版本, 可交换的运算立即数可以来自任一边
+    static const struct {
+        const char *op;
+        const char *imm_op;
+        bool commutative;
+        bool shift;
+    } imm_forms[] = {
+        {"add", "addi", true, false},
+        {"and", "andi", true, false},
+        {"or", "ori", true, false},
+        {"xor", "xori", true, false},
+        {"slt", "slti", false, false},
+        {"sltu", "sltiu", false, false},
+        {"sll", "slli", false, true},
+        {"srl", "srli", false, true},
+        {"sra", "srai", false, true},
+    };
+
+    // 往后只看同一个基本块里的有限几条指令, 看不出来就当作还要用
+    static const int DEAD_WINDOW = 32;
+
+    struct Window {
+        std::vector<Line> lines;
+        std::deque<std::string> strings; // 新算出来的立即数
+
+        int size() const { return lines.size(); }
+
+        // 下一条没删掉的非空行
+        int next(int i) const
+        {
+            int j = i + 1;
+            while (j < size() && (lines[j].removed || lines[j].kind == Line::BLANK))
+                j++;
+            return j;
+        }
+
+        int prev(int i) const
+        {
+            int j = i - 1;
+            while (j >= 0 && (lines[j].removed || lines[j].kind == Line::BLANK))
+                j--;
+            return j;
+        }
+
+        // 第 i 行之后 reg 里的值还会不会被读
+        bool dead_after(int i, std::string_view reg) const
+        {
+            int steps = 0;
+            for (int j = next(i); j < size() && steps < DEAD_WINDOW; j = next(j), steps++) {
+                auto &line = lines[j];
+                if (line.kind != Line::INST)
+                    return is_scratch(reg);
+                if (reads(line, reg))
+                    return false;
+                if (ends_block(line))
+                    return is_scratch(reg);
+                if (has_dest(line) && line.args[0] == reg)
+                    return true;
+            }
+            return false;
+        }
+
+        void remove(int i)
+        {
+            lines[i].removed = true;
+        }
+
+        bool on(Rule rule) const
+        {
+            return enabled_rules >> rule & 1;
+        }
+
+        bool fire(Rule rule)
+        {
+            fired[rule]++;
+            return true;
+        }
+
+        // 以第 i 条指令开头的窗口, 改了就返回 true
+        bool rewrite(int i)
+        {
+            auto &a = lines[i];
+            if (on(SELF_MOVE) && a.op == "mv" && a.args[0] == a.args[1]) {
+                remove(i);
+                return fire(SELF_MOVE);
+            }
+            if (on(JUMP_NEXT) && a.op == "j") {
+                for (int k = next(i); k < size() && lines[k].kind == Line::LABEL; k = next(k)) {
+                    auto label = lines[k].text;
+                    if (label.substr(0, label.size() - 1) == a.args[0]) {
+                        remove(i);
+                        return fire(JUMP_NEXT);
+                    }
+                }
+                return false;
+            }
+
+            int j = next(i);
+            if (j == size() || lines[j].kind != Line::INST)
+                return false;
+            auto &b = lines[j];
+            if (on(MOVE_BACK) && a.op == "mv" && b.op == "mv" && a.args[0] == b.args[1] && a.args[1] == b.args[0]) {
+                remove(j);
+                return fire(MOVE_BACK);
+            }
+            if (on(MOVE_FOLD) && b.op == "mv" && has_dest(a) && a.args[0] == b.args[1] && b.args[0] != b.args[1]
+                && dead_after(j, b.args[1])) {
+                a.args[0] = b.args[0];
+                a.changed = true;
+                remove(j);
+                return fire(MOVE_FOLD);
+            }
+            if (on(STORE_LOAD) && a.op == "sw" && b.op == "lw" && a.args[1] == b.args[1]) {
+                if (b.args[0] == a.args[0]) {
+                    remove(j);
+                } else {
+                    b.op = "mv";
+                    b.args[1] = a.args[0];
+                    b.changed = true;
+                }
+                return fire(STORE_LOAD);
+            }
+            if (on(STORE_LOAD) && a.op == "lw" && b.op == "sw" && a.args[0] == b.args[0] && a.args[1] == b.args[1]
+                && base_of(a.args[1]) != a.args[0]) {
+                remove(j);
+                return fire(STORE_LOAD);
+            }
+
+            if (a.op != "li" || a.args[0] == "zero")
+                return false;
+            auto reg = a.args[0];
+            long imm;
+            if (!parse_imm(a.args[1], imm) || !reads(b, reg) || implicit_read(b, reg))
+                return false;
+            // b 里读的是 li 的值, 之后要么被 b 覆盖, 要么不再用
+            if (!(has_dest(b) && b.args[0] == reg) && !dead_after(j, reg))
+                return false;
+            int first = has_dest(b) ? 1 : 0;
+            if (on(LI_ZERO) && imm == 0) {
+                for (int k = first; k < b.nargs; k++)
+                    if (base_of(b.args[k]) == reg)
+                        return false;
+                for (int k = first; k < b.nargs; k++)
+                    if (b.args[k] == reg)
+                        b.args[k] = "zero";
+                b.changed = true;
+                remove(i);
+                return fire(LI_ZERO);
+            }
+            if (!on(LI_IMM) || b.nargs != 3)
+                return false;
+            if (b.op == "sub") {
+                if (b.args[1] == reg || -imm < -2048 || -imm > 2047)
+                    return false;
+                strings.push_back(std::to_string(-imm));
+                b.op = "addi";
+                b.args[2] = strings.back();
+                b.changed = true;
+                remove(i);
+                return fire(LI_IMM);
+            }
+            for (auto &form : imm_forms) {
+                if (b.op != form.op)
+                    continue;
+                if (form.shift ? (imm < 0 || imm > 31) : (imm < -2048 || imm > 2047))
+                    return false;
+                if (b.args[1] == b.args[2])
+                    return false;
+                if (b.args[1] == reg) {
+                    if (!form.commutative)
+                        return false;
+                    b.args[1] = b.args[2];
+                }
+                b.op = form.imm_op;
+                b.args[2] = a.args[1];
+                b.changed = true;
+                remove(i);
+                return fire(LI_IMM);
+            }
+            return false;
+        }
+    };
+
+    void Run(const std::string &text, AsmWriter &out)
+    {
+        Window window;
+        std::string_view rest(text);
+        while (!rest.empty()) {
+            auto newline = rest.find('\n');
+            window.lines.push_back(parse(rest.substr(0, newline)));
+            if (newline == std::string_view::npos)
+                break;
+            rest = rest.substr(newline + 1);
+        }
+
+        // 每条规则都会少一条指令或者把 lw 换成 mv, 所以一定会停下来
+        // 改过之后退回前一条重新看, 新连在一起的两条指令也能接着合并
+        int i = window.next(-1);
+        while (i < window.size()) {
+            if (window.lines[i].kind != Line::INST || !window.rewrite(i)) {
+                i = window.next(i);
+                continue;
+            }
+            int p = window.prev(i);
+            i = p >= 0 ? p : window.next(-1);
+        }
+
+        for (auto &line : window.lines) {
+            if (line.removed)
+                continue;
+            if (!line.changed) {
+                out.write(line.text.data(), line.text.size());
+            } else {
+                out << "  ";
+                out.write(line.op.data(), line.op.size());
+                for (int k = 0; k < line.nargs; k++) {
+                    out << (k == 0 ? " " : ", ");
+                    out.write(line.args[k].data(), line.args[k].size());
+                }
+            }
+            out << '\n';
+        }
+    }
+}
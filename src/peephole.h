@@ -0,0 +1,20 @@
+#pragma once
+
+#include <string>
+#include "asmwriter.h"
+
+// 输出的 RISC-V 汇编上的窥孔优化
+// 每个函数输出完以后, 在它的文本上按规则反复改写相邻的几条指令, 直到没有规则能触发
+namespace Peephole {
+    // 选择启用的规则: all, none, 或者逗号分隔的规则名; 有不认识的名字时返回 false
+    bool configure(const std::string &spec);
+    bool enabled();
+
+    // 改写一个函数的汇编文本, 结果追加到 out
+    void Run(const std::string &text, AsmWriter &out);
+
+    // 各条规则触发的次数写进 Timing 的计数器
+    void report();
+    // 触发次数清零, 每次编译开始时调用
+    void reset();
+}
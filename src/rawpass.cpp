@@ -0,0 +1,168 @@
+#include "rawpass.h"
+#include "arena.h"
+#include <cassert>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace RawPass {
+    // 名字表: 冲突时追加 _0, _1, ... 直到唯一
+    class NameTable {
+    public:
+        const char* unique(const char* name)
+        {
+            std::string base = name;
+            if (used.insert(base).second)
+                return name;
+            int& counter = counters[base];
+            std::string candidate;
+            do {
+                candidate = base + "_" + std::to_string(counter++);
+            } while (!used.insert(candidate).second);
+            return ir_arena.copy_string(candidate);
+        }
+        // 只占用名字, 不改名
+        void reserve(const char* name)
+        {
+            used.insert(name);
+        }
+    private:
+        std::unordered_set<std::string> used;
+        std::unordered_map<std::string, int> counters;
+    };
+
+    // 带前缀(@ 或 %)的新名字
+    static const char* with_sigil(char sigil, const char* name)
+    {
+        auto result = ir_arena.make_array<char>(strlen(name) + 2);
+        result[0] = sigil;
+        strcpy(result + 1, name);
+        return result;
+    }
+
+    void Prepare(koopa_raw_program_t &program)
+    {
+        UniquifyNames(program);
+        BuildUseLists(program);
+    }
+
+    void UniquifyNames(koopa_raw_program_t &program)
+    {
+        // 函数名, 全局变量名和基本块名最后都会变成汇编里的标号, 放在同一张表里
+        NameTable labels;
+        for (uint32_t i = 0; i < program.funcs.len; i++) {
+            auto func = (koopa_raw_function_data_t*)program.funcs.buffer[i];
+            labels.reserve(func->name + 1);
+        }
+        for (uint32_t i = 0; i < program.values.len; i++) {
+            auto value = (koopa_raw_value_data_t*)program.values.buffer[i];
+            auto name = labels.unique(value->name + 1);
+            if (name != value->name + 1)
+                value->name = with_sigil(value->name[0], name);
+        }
+        for (uint32_t i = 0; i < program.funcs.len; i++) {
+            auto func = (koopa_raw_function_data_t*)program.funcs.buffer[i];
+            NameTable locals;
+            for (uint32_t j = 0; j < program.values.len; j++)
+                locals.reserve(((koopa_raw_value_t)program.values.buffer[j])->name);
+            auto rename_local = [&](koopa_raw_value_data_t* value) {
+                if (value->name != nullptr)
+                    value->name = locals.unique(value->name);
+            };
+            for (uint32_t j = 0; j < func->params.len; j++)
+                rename_local((koopa_raw_value_data_t*)func->params.buffer[j]);
+            for (uint32_t j = 0; j < func->bbs.len; j++) {
+                auto bb = (koopa_raw_basic_block_data_t*)func->bbs.buffer[j];
+                assert(bb->name != nullptr);
+                auto name = labels.unique(bb->name + 1);
+                if (name != bb->name + 1)
+                    bb->name = with_sigil(bb->name[0], name);
+                for (uint32_t k = 0; k < bb->params.len; k++)
+                    rename_local((koopa_raw_value_data_t*)bb->params.buffer[k]);
+                for (uint32_t k = 0; k < bb->insts.len; k++)
+                    rename_local((koopa_raw_value_data_t*)bb->insts.buffer[k]);
+            }
+        }
+    }
+
+    void BuildUseLists(koopa_raw_program_t &program)
+    {
+        std::vector<koopa_raw_value_data_t*> values;
+        std::vector<koopa_raw_basic_block_data_t*> bbs;
+        for (uint32_t i = 0; i < program.values.len; i++)
+            values.push_back((koopa_raw_value_data_t*)program.values.buffer[i]);
+        for (uint32_t i = 0; i < program.funcs.len; i++) {
+            auto func = (koopa_raw_function_t)program.funcs.buffer[i];
+            for (uint32_t j = 0; j < func->params.len; j++)
+                values.push_back((koopa_raw_value_data_t*)func->params.buffer[j]);
+            for (uint32_t j = 0; j < func->bbs.len; j++) {
+                auto bb = (koopa_raw_basic_block_data_t*)func->bbs.buffer[j];
+                bbs.push_back(bb);
+                for (uint32_t k = 0; k < bb->params.len; k++)
+                    values.push_back((koopa_raw_value_data_t*)bb->params.buffer[k]);
+                for (uint32_t k = 0; k < bb->insts.len; k++)
+                    values.push_back((koopa_raw_value_data_t*)bb->insts.buffer[k]);
+            }
+        }
+
+        for (auto value : values)
+            value->used_by = {nullptr, 0, KOOPA_RSIK_VALUE};
+        for (auto bb : bbs)
+            bb->used_by = {nullptr, 0, KOOPA_RSIK_VALUE};
+
+        // 第一遍数使用次数, 第二遍按次数分配好缓冲区后填入
+        auto count_bb = [](koopa_raw_basic_block_t bb) {
+            ((koopa_raw_basic_block_data_t*)bb)->used_by.len++;
+        };
+        auto add_bb = [](koopa_raw_basic_block_t bb, koopa_raw_value_t user) {
+            auto data = (koopa_raw_basic_block_data_t*)bb;
+            data->used_by.buffer[data->used_by.len++] = user;
+        };
+        for (auto bb : bbs) {
+            for (uint32_t k = 0; k < bb->insts.len; k++) {
+                auto inst = (koopa_raw_value_t)bb->insts.buffer[k];
+                for_each_operand(inst, [](koopa_raw_value_t operand) {
+                    if (!is_constant(operand))
+                        ((koopa_raw_value_data_t*)operand)->used_by.len++;
+                });
+                if (inst->kind.tag == KOOPA_RVT_BRANCH) {
+                    count_bb(inst->kind.data.branch.true_bb);
+                    count_bb(inst->kind.data.branch.false_bb);
+                }
+                else if (inst->kind.tag == KOOPA_RVT_JUMP)
+                    count_bb(inst->kind.data.jump.target);
+            }
+        }
+
+        for (auto value : values) {
+            if (value->used_by.len > 0)
+                value->used_by.buffer = ir_arena.make_array<const void*>(value->used_by.len);
+            value->used_by.len = 0;
+        }
+        for (auto bb : bbs) {
+            if (bb->used_by.len > 0)
+                bb->used_by.buffer = ir_arena.make_array<const void*>(bb->used_by.len);
+            bb->used_by.len = 0;
+        }
+
+        for (auto bb : bbs) {
+            for (uint32_t k = 0; k < bb->insts.len; k++) {
+                auto inst = (koopa_raw_value_t)bb->insts.buffer[k];
+                for_each_operand(inst, [inst](koopa_raw_value_t operand) {
+                    if (!is_constant(operand)) {
+                        auto data = (koopa_raw_value_data_t*)operand;
+                        data->used_by.buffer[data->used_by.len++] = inst;
+                    }
+                });
+                if (inst->kind.tag == KOOPA_RVT_BRANCH) {
+                    add_bb(inst->kind.data.branch.true_bb, inst);
+                    add_bb(inst->kind.data.branch.false_bb, inst);
+                }
+                else if (inst->kind.tag == KOOPA_RVT_JUMP)
+                    add_bb(inst->kind.data.jump.target, inst);
+            }
+        }
+    }
+}
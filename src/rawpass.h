@@ -0,0 +1,88 @@
+#pragma once
+
+#include "koopa.h"
+
+// 直接作用在前端生成的 raw program 上的处理
+// 之前 -riscv 要先 dump 成字符串再 parse 回来, 只是为了拿到唯一的名字和 used_by,
+// 现在由这里原地完成
+namespace RawPass {
+    // 后端需要的全部准备工作: 名字唯一化 + 建立 used_by
+    void Prepare(koopa_raw_program_t &program);
+
+    // 全局变量/基本块/局部值的名字唯一化, 基本块名在整个程序里唯一(后端直接拿来当标号)
+    void UniquifyNames(koopa_raw_program_t &program);
+
+    // 重新建立所有值和基本块的 used_by, 常量不记录使用者
+    void BuildUseLists(koopa_raw_program_t &program);
+
+    inline bool is_constant(koopa_raw_value_t value)
+    {
+        switch (value->kind.tag) {
+            case KOOPA_RVT_INTEGER:
+            case KOOPA_RVT_ZERO_INIT:
+            case KOOPA_RVT_UNDEF:
+            case KOOPA_RVT_AGGREGATE:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    // 对指令的每个操作数的引用调用 f, 优化时可以直接改写操作数
+    template <typename F>
+    void for_each_operand_ref(koopa_raw_value_data_t* inst, F f)
+    {
+        auto& kind = inst->kind;
+        auto for_slice = [&](koopa_raw_slice_t& slice) {
+            for (uint32_t i = 0; i < slice.len; i++)
+                f(reinterpret_cast<koopa_raw_value_t&>(slice.buffer[i]));
+        };
+        switch (kind.tag) {
+            case KOOPA_RVT_LOAD:
+                f(kind.data.load.src);
+                break;
+            case KOOPA_RVT_STORE:
+                f(kind.data.store.value);
+                f(kind.data.store.dest);
+                break;
+            case KOOPA_RVT_GET_PTR:
+                f(kind.data.get_ptr.src);
+                f(kind.data.get_ptr.index);
+                break;
+            case KOOPA_RVT_GET_ELEM_PTR:
+                f(kind.data.get_elem_ptr.src);
+                f(kind.data.get_elem_ptr.index);
+                break;
+            case KOOPA_RVT_BINARY:
+                f(kind.data.binary.lhs);
+                f(kind.data.binary.rhs);
+                break;
+            case KOOPA_RVT_BRANCH:
+                f(kind.data.branch.cond);
+                for_slice(kind.data.branch.true_args);
+                for_slice(kind.data.branch.false_args);
+                break;
+            case KOOPA_RVT_JUMP:
+                for_slice(kind.data.jump.args);
+                break;
+            case KOOPA_RVT_CALL:
+                for_slice(kind.data.call.args);
+                break;
+            case KOOPA_RVT_RETURN:
+                if (kind.data.ret.value != nullptr)
+                    f(kind.data.ret.value);
+                break;
+            default:
+                break;
+        }
+    }
+
+    // 对指令的每个操作数调用 f
+    template <typename F>
+    void for_each_operand(koopa_raw_value_t inst, F f)
+    {
+        for_each_operand_ref((koopa_raw_value_data_t*)inst, [&](koopa_raw_value_t& operand) {
+            f(operand);
+        });
+    }
+}
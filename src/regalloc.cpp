@@ -0,0 +1,216 @@
+#include "regalloc.h"
+#include "cfg.h"
+#include "rawpass.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+namespace RegAlloc {
+    const char* name(int reg)
+    {
+        static const char* const reg_names[] = {
+            "t0", "t1", "t2", "t3",
+            "a0", "a1", "a2", "a3", "a4", "a5", "a6", "a7",
+            "s0", "s1", "s2", "s3", "s4", "s5", "s6", "s7", "s8", "s9", "s10", "s11",
+        };
+        assert(reg >= 0 && reg < N_REGS);
+        return reg_names[reg];
+    }
+
+    struct Interval {
+        koopa_raw_value_t value;
+        int from;
+        int to;
+        double weight;
+        int def_block;
+        bool crosses_call;
+        // 最好分到的寄存器: 参数/返回值所在的 a 寄存器, 分到它可以省掉一次 mv
+        int hint;
+        // 在定义所在块以外使用它的块
+        std::vector<int> outside_uses;
+    };
+
+    // 需要占一个位置保存的指令结果
+    static bool needs_location(koopa_raw_value_t value)
+    {
+        if (value->used_by.len == 0)
+            return false;
+        switch (value->kind.tag) {
+            case KOOPA_RVT_BINARY:
+            case KOOPA_RVT_LOAD:
+            case KOOPA_RVT_CALL:
+            case KOOPA_RVT_GET_PTR:
+            case KOOPA_RVT_GET_ELEM_PTR:
+            case KOOPA_RVT_FUNC_ARG_REF:
+            case KOOPA_RVT_BLOCK_ARG_REF:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    // 循环里的使用更重要, 每深一层按 10 倍算
+    static double block_weight(int depth)
+    {
+        return std::pow(10.0, std::min(depth, 8));
+    }
+
+    Result Allocate(koopa_raw_function_t func)
+    {
+        CFG cfg(func);
+        int n_blocks = cfg.size();
+
+        std::vector<Interval> intervals;
+        std::unordered_map<koopa_raw_value_t, int> id;
+        auto define = [&](koopa_raw_value_t value, int pos, int block) {
+            if (!needs_location(value))
+                return;
+            id[value] = (int)intervals.size();
+            intervals.push_back({value, pos, pos, block_weight(cfg.loop_depth[block]), block, false, -1, {}});
+        };
+
+        // 给指令线性编号: 块的入口占一个位置 (基本块参数在这里定义),
+        // 每条指令在 2k+1 使用操作数, 在 2k+2 定义结果, 所以结果可以和最后一次使用的操作数共用寄存器
+        // 0 号位置留给函数参数
+        std::vector<int> block_entry(n_blocks), block_end(n_blocks);
+        std::vector<int> calls;
+        auto hint = [&](koopa_raw_value_t value, int reg) {
+            auto it = id.find(value);
+            if (it != id.end() && intervals[it->second].hint == -1)
+                intervals[it->second].hint = reg;
+        };
+        for (uint32_t i = 0; i < func->params.len; i++) {
+            define((koopa_raw_value_t)func->params.buffer[i], 0, 0);
+            if (i < 8)
+                hint((koopa_raw_value_t)func->params.buffer[i], A0 + i);
+        }
+        int pos = 1;
+        for (int b = 0; b < n_blocks; b++) {
+            auto bb = cfg.blocks[b];
+            double weight = block_weight(cfg.loop_depth[b]);
+            block_entry[b] = pos;
+            for (uint32_t i = 0; i < bb->params.len; i++)
+                define((koopa_raw_value_t)bb->params.buffer[i], pos, b);
+            for (uint32_t i = 0; i < bb->insts.len; i++) {
+                auto inst = (koopa_raw_value_t)bb->insts.buffer[i];
+                int use_pos = pos + 1 + 2 * i;
+                RawPass::for_each_operand(inst, [&](koopa_raw_value_t operand) {
+                    auto it = id.find(operand);
+                    if (it == id.end())
+                        return;
+                    auto &interval = intervals[it->second];
+                    interval.to = std::max(interval.to, use_pos);
+                    interval.weight += weight;
+                    if (interval.def_block != b)
+                        interval.outside_uses.push_back(b);
+                });
+                if (inst->kind.tag == KOOPA_RVT_CALL) {
+                    calls.push_back(use_pos);
+                    auto &args = inst->kind.data.call.args;
+                    for (uint32_t k = 0; k < args.len && k < 8; k++)
+                        hint((koopa_raw_value_t)args.buffer[k], A0 + k);
+                } else if (inst->kind.tag == KOOPA_RVT_RETURN && inst->kind.data.ret.value != nullptr) {
+                    hint(inst->kind.data.ret.value, A0);
+                }
+                define(inst, use_pos + 1, b);
+                if (inst->kind.tag == KOOPA_RVT_CALL)
+                    hint(inst, A0);
+            }
+            block_end[b] = pos + 2 * bb->insts.len;
+            pos = block_end[b] + 1;
+        }
+
+        // 活跃分析: 从每个块外的使用倒着走到定义所在的块, 途经的块入口处活跃, 前驱出口处活跃
+        std::vector<int> live_in_mark(n_blocks, -1);
+        for (int v = 0; v < (int)intervals.size(); v++) {
+            auto &interval = intervals[v];
+            std::vector<int> worklist;
+            for (auto b : interval.outside_uses)
+                if (live_in_mark[b] != v) {
+                    live_in_mark[b] = v;
+                    worklist.push_back(b);
+                }
+            while (!worklist.empty()) {
+                int b = worklist.back();
+                worklist.pop_back();
+                interval.from = std::min(interval.from, block_entry[b]);
+                for (auto p : cfg.preds[b]) {
+                    interval.to = std::max(interval.to, block_end[p]);
+                    if (p != interval.def_block && live_in_mark[p] != v) {
+                        live_in_mark[p] = v;
+                        worklist.push_back(p);
+                    }
+                }
+            }
+            interval.outside_uses = std::vector<int>();
+            auto c = std::upper_bound(calls.begin(), calls.end(), interval.from);
+            interval.crosses_call = c != calls.end() && *c < interval.to;
+        }
+
+        // 线性扫描
+        Result result;
+        std::vector<Interval*> order;
+        for (auto &interval : intervals)
+            order.push_back(&interval);
+        std::sort(order.begin(), order.end(), [](const Interval* a, const Interval* b) {
+            return a->from < b->from;
+        });
+
+        std::vector<Interval*> active;
+        Interval* holder[N_REGS] = {};
+        bool used[N_REGS] = {};
+        auto spill = [&](Interval* interval) {
+            result.locations[interval->value] = {-1, result.spill_slots++};
+        };
+        auto assign = [&](Interval* interval, int reg) {
+            holder[reg] = interval;
+            used[reg] = true;
+            active.push_back(interval);
+            result.locations[interval->value] = {reg, 0};
+        };
+        for (auto current : order) {
+            // 结束的区间释放寄存器
+            for (size_t i = 0; i < active.size();) {
+                if (active[i]->to < current->from) {
+                    holder[result.locations[active[i]->value].reg] = nullptr;
+                    active[i] = active.back();
+                    active.pop_back();
+                } else {
+                    i++;
+                }
+            }
+            int first = current->crosses_call ? S0 : T0;
+            int reg = -1;
+            if (current->hint >= first && holder[current->hint] == nullptr)
+                reg = current->hint;
+            for (int r = first; r < N_REGS && reg == -1; r++)
+                if (holder[r] == nullptr)
+                    reg = r;
+            if (reg != -1) {
+                assign(current, reg);
+                continue;
+            }
+            // 没有空位, 在能用的寄存器里找权重最小的, 一样时找结束得最晚的
+            int victim = -1;
+            for (int r = first; r < N_REGS; r++) {
+                if (victim == -1 || holder[r]->weight < holder[victim]->weight
+                    || (holder[r]->weight == holder[victim]->weight && holder[r]->to > holder[victim]->to))
+                    victim = r;
+            }
+            auto other = holder[victim];
+            if (other->weight < current->weight
+                || (other->weight == current->weight && other->to > current->to)) {
+                active.erase(std::find(active.begin(), active.end(), other));
+                spill(other);
+                assign(current, victim);
+            } else {
+                spill(current);
+            }
+        }
+
+        for (int r = S0; r < N_REGS; r++)
+            if (used[r])
+                result.used_callee_saved.push_back(r);
+        return result;
+    }
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+#include "koopa.h"
+
+// 函数级的线性扫描寄存器分配 (Poletto & Sarkar)
+// 在 CFG 上求出每个值的活跃范围, 按指令的线性编号合成一个区间, 再按起点顺序分配
+// 跨过 call 的区间只能放进 callee-saved 的 s0-s11, 其他的依次优先用 t0-t3, a0-a7
+// 函数参数, 调用的实参和结果, 返回值优先放进约定的 a 寄存器, 省掉传参时的 mv
+// 寄存器不够时溢出权重最小的区间, 权重是每次定义和使用按所在循环深度加权求和
+// t4-t6 留给后端装载常量/溢出的值, 计算大偏移和拆并行赋值的环
+namespace RegAlloc {
+    enum Reg {
+        T0, T1, T2, T3,
+        A0, A1, A2, A3, A4, A5, A6, A7,
+        S0, S1, S2, S3, S4, S5, S6, S7, S8, S9, S10, S11,
+        N_REGS
+    };
+
+    const char* name(int reg);
+    inline bool callee_saved(int reg) { return reg >= S0; }
+
+    // reg 为 -1 时值溢出在栈上的第 slot 个槽
+    struct Location {
+        int reg;
+        int slot;
+    };
+
+    struct Result {
+        // 需要保存结果的值: 有使用者的指令, 函数参数和基本块参数
+        // 常量, alloc 和全局变量用到时现场生成, 不在这里
+        std::unordered_map<koopa_raw_value_t, Location> locations;
+        int spill_slots = 0;
+        // 用到的 callee-saved 寄存器, 需要在序言里保存
+        std::vector<int> used_callee_saved;
+    };
+
+    Result Allocate(koopa_raw_function_t func);
+}
@@ -0,0 +1,218 @@
+#include "opt.h"
+#include "cfg.h"
+#include "constpool.h"
+#include "rawpass.h"
+#include <climits>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace Opt {
+    // 格: 还没算出来 (TOP), 常量, 不是常量 (BOTTOM), 只会往下走
+    struct Lattice {
+        enum State { TOP, CONST, BOTTOM } state;
+        int value;
+
+        bool operator==(const Lattice &other) const
+        {
+            return state == other.state && (state != CONST || value == other.value);
+        }
+    };
+
+    static Lattice meet(Lattice a, Lattice b)
+    {
+        if (a.state == Lattice::TOP)
+            return b;
+        if (b.state == Lattice::TOP)
+            return a;
+        if (a == b)
+            return a;
+        return {Lattice::BOTTOM, 0};
+    }
+
+    // 按 RISC-V 的语义计算, 结果和运行时一致; 除以 0 不折叠, 留给运行时
+    static bool evaluate(koopa_raw_binary_op_t op, int left, int right, int &result)
+    {
+        uint32_t l = left, r = right;
+        switch (op) {
+            case KOOPA_RBO_NOT_EQ: result = left != right; break;
+            case KOOPA_RBO_EQ: result = left == right; break;
+            case KOOPA_RBO_GT: result = left > right; break;
+            case KOOPA_RBO_LT: result = left < right; break;
+            case KOOPA_RBO_GE: result = left >= right; break;
+            case KOOPA_RBO_LE: result = left <= right; break;
+            case KOOPA_RBO_ADD: result = (int)(l + r); break;
+            case KOOPA_RBO_SUB: result = (int)(l - r); break;
+            case KOOPA_RBO_MUL: result = (int)(l * r); break;
+            case KOOPA_RBO_AND: result = left & right; break;
+            case KOOPA_RBO_OR: result = left | right; break;
+            case KOOPA_RBO_XOR: result = left ^ right; break;
+            case KOOPA_RBO_SHL: result = (int)(l << (r & 31)); break;
+            case KOOPA_RBO_SHR: result = (int)(l >> (r & 31)); break;
+            case KOOPA_RBO_SAR: result = left >> (r & 31); break;
+            case KOOPA_RBO_DIV:
+            case KOOPA_RBO_MOD:
+                if (right == 0)
+                    return false;
+                if (left == INT_MIN && right == -1)
+                    result = op == KOOPA_RBO_DIV ? INT_MIN : 0;
+                else
+                    result = op == KOOPA_RBO_DIV ? left / right : left % right;
+                break;
+            default:
+                return false;
+        }
+        return true;
+    }
+
+    // Wegman & Zadeck 的稀疏条件常量传播
+    // 只沿着可能执行的边传播, 基本块参数的值是所有可执行入边上实参的交汇
+    // 结束后把常量替换进所有使用处, 条件是常量的分支改成 jump
+    // 走不到的块和没用的值留给 DeadCodeElim 删除
+    void SCCP(koopa_raw_function_t func)
+    {
+        CFG cfg(func, false);
+        int n = cfg.size();
+
+        std::unordered_map<koopa_raw_value_t, int> block_of;
+        for (int b = 0; b < n; b++) {
+            auto bb = cfg.blocks[b];
+            for (uint32_t i = 0; i < bb->params.len; i++)
+                block_of[(koopa_raw_value_t)bb->params.buffer[i]] = b;
+            for (uint32_t i = 0; i < bb->insts.len; i++)
+                block_of[(koopa_raw_value_t)bb->insts.buffer[i]] = b;
+        }
+
+        std::unordered_map<koopa_raw_value_t, Lattice> values;
+        auto get = [&](koopa_raw_value_t value) -> Lattice {
+            if (value->kind.tag == KOOPA_RVT_INTEGER)
+                return {Lattice::CONST, value->kind.data.integer.value};
+            auto it = values.find(value);
+            if (it != values.end())
+                return it->second;
+            // 函数内定义的值从 TOP 开始, 函数参数, 全局变量之类的一开始就不知道
+            return {block_of.count(value) ? Lattice::TOP : Lattice::BOTTOM, 0};
+        };
+
+        std::vector<bool> executable(n, false);
+        // 每个块出口的两条边, jump 只用第一条
+        std::vector<bool> edge_executable(2 * n, false);
+        std::vector<int> block_worklist;
+        std::vector<koopa_raw_value_t> value_worklist;
+
+        auto update = [&](koopa_raw_value_t value, Lattice lattice) {
+            auto old = get(value);
+            lattice = meet(old, lattice);
+            if (lattice == old)
+                return;
+            values[value] = lattice;
+            value_worklist.push_back(value);
+        };
+        // 一条可执行的边把实参交汇到目标块的参数上
+        auto flow = [&](const koopa_raw_slice_t &args, koopa_raw_basic_block_t target) {
+            for (uint32_t i = 0; i < args.len; i++)
+                update((koopa_raw_value_t)target->params.buffer[i], get((koopa_raw_value_t)args.buffer[i]));
+        };
+        auto mark_edge = [&](int b, int which, koopa_raw_basic_block_t target) {
+            if (edge_executable[2 * b + which])
+                return;
+            edge_executable[2 * b + which] = true;
+            int t = cfg.index_of(target);
+            if (!executable[t]) {
+                executable[t] = true;
+                block_worklist.push_back(t);
+            }
+        };
+
+        auto visit = [&](koopa_raw_value_t inst, int b) {
+            auto &kind = inst->kind;
+            switch (kind.tag) {
+                case KOOPA_RVT_BINARY: {
+                    auto left = get(kind.data.binary.lhs), right = get(kind.data.binary.rhs);
+                    if (left.state == Lattice::BOTTOM || right.state == Lattice::BOTTOM) {
+                        update(inst, {Lattice::BOTTOM, 0});
+                    } else if (left.state == Lattice::CONST && right.state == Lattice::CONST) {
+                        int result;
+                        if (evaluate(kind.data.binary.op, left.value, right.value, result))
+                            update(inst, {Lattice::CONST, result});
+                        else
+                            update(inst, {Lattice::BOTTOM, 0});
+                    }
+                    break;
+                }
+                case KOOPA_RVT_BRANCH: {
+                    auto &branch = kind.data.branch;
+                    auto cond = get(branch.cond);
+                    if (cond.state == Lattice::TOP)
+                        break;
+                    if (cond.state == Lattice::BOTTOM || cond.value != 0)
+                        mark_edge(b, 0, branch.true_bb);
+                    if (cond.state == Lattice::BOTTOM || cond.value == 0)
+                        mark_edge(b, 1, branch.false_bb);
+                    if (edge_executable[2 * b])
+                        flow(branch.true_args, branch.true_bb);
+                    if (edge_executable[2 * b + 1])
+                        flow(branch.false_args, branch.false_bb);
+                    break;
+                }
+                case KOOPA_RVT_JUMP:
+                    mark_edge(b, 0, kind.data.jump.target);
+                    flow(kind.data.jump.args, kind.data.jump.target);
+                    break;
+                case KOOPA_RVT_STORE:
+                case KOOPA_RVT_RETURN:
+                    break;
+                default:
+                    // load, call 和地址计算的结果都不当作常量
+                    update(inst, {Lattice::BOTTOM, 0});
+                    break;
+            }
+        };
+
+        executable[0] = true;
+        block_worklist.push_back(0);
+        while (!block_worklist.empty() || !value_worklist.empty()) {
+            while (!block_worklist.empty()) {
+                int b = block_worklist.back();
+                block_worklist.pop_back();
+                auto bb = cfg.blocks[b];
+                for (uint32_t i = 0; i < bb->insts.len; i++)
+                    visit((koopa_raw_value_t)bb->insts.buffer[i], b);
+            }
+            while (!value_worklist.empty() && block_worklist.empty()) {
+                auto value = value_worklist.back();
+                value_worklist.pop_back();
+                for (uint32_t i = 0; i < value->used_by.len; i++) {
+                    auto user = (koopa_raw_value_t)value->used_by.buffer[i];
+                    auto it = block_of.find(user);
+                    if (it != block_of.end() && executable[it->second])
+                        visit(user, it->second);
+                }
+            }
+        }
+
+        // 改写: 常量替换进使用处, 只有一条边可执行的分支改成 jump
+        for (int b = 0; b < n; b++) {
+            if (!executable[b])
+                continue;
+            auto bb = cfg.blocks[b];
+            for (uint32_t i = 0; i < bb->insts.len; i++) {
+                auto inst = (koopa_raw_value_data_t*)bb->insts.buffer[i];
+                RawPass::for_each_operand_ref(inst, [&](koopa_raw_value_t &operand) {
+                    auto lattice = get(operand);
+                    if (lattice.state == Lattice::CONST && operand->kind.tag != KOOPA_RVT_INTEGER)
+                        operand = ConstPool::get(lattice.value);
+                });
+                if (inst->kind.tag != KOOPA_RVT_BRANCH)
+                    continue;
+                auto branch = inst->kind.data.branch;
+                bool true_edge = edge_executable[2 * b], false_edge = edge_executable[2 * b + 1];
+                if (true_edge == false_edge)
+                    continue;
+                inst->kind.tag = KOOPA_RVT_JUMP;
+                inst->kind.data.jump.target = true_edge ? branch.true_bb : branch.false_bb;
+                inst->kind.data.jump.args = true_edge ? branch.true_args : branch.false_args;
+            }
+        }
+    }
+}
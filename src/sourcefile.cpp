@@ -0,0 +1,52 @@
+#include "sourcefile.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+bool SourceFile::map(const char* path)
+{
+    unmap();
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return false;
+    }
+
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t size = st.st_size;
+    size_t total = (size + 2 + page - 1) / page * page;
+
+    // 先占一段匿名的全零内存, 再把文件盖在开头
+    // 文件最后一页超出文件长度的部分也是零, 所以末尾一定有两个 '\0'
+    // 用 MAP_PRIVATE + 可写, flex 扫描时临时改写的字节不会写回文件
+    auto region = (char*)mmap(nullptr, total, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (region == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+    if (size > 0 && mmap(region, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        munmap(region, total);
+        close(fd);
+        return false;
+    }
+    close(fd);
+    madvise(region, total, MADV_SEQUENTIAL);
+
+    base = region;
+    file_size = size;
+    map_size = total;
+    return true;
+}
+
+void SourceFile::unmap()
+{
+    if (base != nullptr)
+        munmap(base, map_size);
+    base = nullptr;
+    file_size = 0;
+    map_size = 0;
+}
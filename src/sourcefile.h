@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstddef>
+
+// 把源文件私有可写 (MAP_PRIVATE, 写时复制) 地映射到内存, lexer 直接在映射上扫描, 不再经过 stdio 和 flex 自己的读缓冲
+// flex 扫描时会临时改写缓冲区, 改动只在这份私有副本里, 不会写回文件
+// flex 的 yy_scan_buffer 要求缓冲区最后两个字节是 '\0', 映射时会多留出这两个字节
+class SourceFile
+{
+public:
+    SourceFile() = default;
+    SourceFile(const SourceFile&) = delete;
+    SourceFile& operator=(const SourceFile&) = delete;
+    ~SourceFile() { unmap(); }
+
+    // 只对普通文件做映射, 管道/终端等返回 false, 由调用者退回 fopen
+    bool map(const char* path);
+    void unmap();
+
+    // 文件内容, 后面紧跟两个 '\0'
+    char* data() const { return base; }
+    size_t size() const { return file_size; }
+    // 交给 yy_scan_buffer 的长度, 包含末尾的两个 '\0'
+    size_t scan_size() const { return file_size + 2; }
+
+private:
+    char* base = nullptr;
+    size_t file_size = 0;
+    size_t map_size = 0;
+};
@@ -1,63 +1,113 @@
 #include "symtab.h"
-#include <map>
+#include "compiler.h"
+#include <algorithm>
 #include <vector>
 #include <cassert>
 
 namespace Symbol {
-    int scope_level = -1;
-    std::vector<std::map<std::string, symbol_val>> symtab_stack;
-    std::stack<std::pair<koopa_raw_basic_block_data_t*, koopa_raw_basic_block_data_t*>> loop_stack;
+    // 所有作用域共用一张表, 标识符编号是连续的, 直接用编号当下标
+    // top[id] 指向该名字当前可见的绑定, 绑定通过 prev 串起被它遮蔽的外层绑定
+    // bindings 按插入顺序存放, 同时就是撤销日志: leave_scope 从尾部弹出本层的绑定
+    struct Binding {
+        symbol_val val;
+        ident_id ident;
+        int prev; // 被遮蔽的绑定, -1 表示没有
+        int level;
+    };
 
-    void insert(const std::string &ident, Type type, int int_value)
+    // 每个线程一张符号表
+    thread_local int scope_level = -1;
+    thread_local std::vector<int> top; // -1 表示没有可见的绑定
+    thread_local std::vector<Binding> bindings;
+    thread_local std::vector<size_t> scope_marks; // 每层作用域开始时 bindings 的长度
+    thread_local std::stack<std::pair<koopa_raw_basic_block_data_t*, koopa_raw_basic_block_data_t*>> loop_stack;
+    // 数组的各维长度, 绑定里只存指针, reset 时统一释放
+    thread_local std::vector<std::unique_ptr<std::vector<int>>> dims;
+
+    static void bind(ident_id ident, const symbol_val &val)
     {
-        if (symtab_stack[scope_level].find(ident) != symtab_stack[scope_level].end())
-            assert(false);
-        symtab_stack[scope_level][ident] = {type, int_value, nullptr, nullptr};
+        if ((size_t)ident >= top.size())
+            top.resize(std::max((size_t)ident + 1, Interner::size()), -1);
+        int prev = top[ident];
+        // 同一作用域内不能重复定义
+        if (prev != -1 && bindings[prev].level == scope_level)
+            throw CompileError(std::string("redefinition of ") + Interner::name(ident));
+        bindings.push_back({val, ident, prev, scope_level});
+        top[ident] = bindings.size() - 1;
+    }
+
+    void insert(ident_id ident, Type type, int int_value)
+    {
+        bind(ident, {type, int_value, nullptr, nullptr, nullptr, nullptr});
     }
     
-    void insert(const std::string &ident, Type type, koopa_raw_value_data_t* allocator)
+    void insert(ident_id ident, Type type, koopa_raw_value_data_t* allocator)
     {
-        if (symtab_stack[scope_level].find(ident) != symtab_stack[scope_level].end())
-            assert(false);
-        symtab_stack[scope_level][ident] = {type, 0, allocator, nullptr, nullptr};
+        bind(ident, {type, 0, allocator, nullptr, nullptr, nullptr});
     }
 
-    void insert(const std::string &ident, Type type, koopa_raw_function_data_t* function)
+    void insert(ident_id ident, Type type, koopa_raw_function_data_t* function)
     {
-        if (symtab_stack[scope_level].find(ident) != symtab_stack[scope_level].end())
-            assert(false);
-        symtab_stack[scope_level][ident] = {type, 0, nullptr, function, nullptr};
+        bind(ident, {type, 0, nullptr, function, nullptr, nullptr});
     }
 
-    void insert(const std::string &ident, Type type, koopa_raw_value_data_t* allocator, std::vector<int>* dim_vec)
+    std::vector<int>* new_dims()
     {
-        if (symtab_stack[scope_level].find(ident) != symtab_stack[scope_level].end())
-            assert(false);
-        symtab_stack[scope_level][ident] = {type, 0, allocator, nullptr, dim_vec};
+        dims.push_back(std::make_unique<std::vector<int>>());
+        return dims.back().get();
     }
 
-    symbol_val query(const std::string &ident)
+    void insert(ident_id ident, Type type, koopa_raw_value_data_t* allocator, std::vector<int>* dim_vec)
     {
-        for (int i = scope_level; i >= 0; i--)
-        {
-            if (symtab_stack[i].find(ident) != symtab_stack[i].end())
-                return symtab_stack[i][ident];
-        }
-        return {TYPE_VAR, 0, nullptr, nullptr, nullptr};
+        bind(ident, {type, 0, allocator, nullptr, dim_vec, nullptr});
+    }
+
+    void insert(ident_id ident, Type type, koopa_raw_value_data_t* allocator, std::vector<int>* dim_vec, const ConstArray* const_array)
+    {
+        bind(ident, {type, 0, allocator, nullptr, dim_vec, const_array});
+    }
+
+    const symbol_val &query(ident_id ident)
+    {
+        static const symbol_val not_found = {TYPE_VAR, 0, nullptr, nullptr, nullptr, nullptr};
+        if ((size_t)ident >= top.size() || top[ident] == -1)
+            return not_found;
+        return bindings[top[ident]].val;
+    }
+
+    bool exists(ident_id ident)
+    {
+        return (size_t)ident < top.size() && top[ident] != -1;
     }
 
     void enter_scope()
     {
-        symtab_stack.push_back(std::map<std::string, symbol_val>());
+        scope_marks.push_back(bindings.size());
         scope_level++;
     }
 
     void leave_scope()
     {
-        symtab_stack.pop_back();
+        size_t mark = scope_marks.back();
+        scope_marks.pop_back();
+        while (bindings.size() > mark) {
+            auto &binding = bindings.back();
+            top[binding.ident] = binding.prev;
+            bindings.pop_back();
+        }
         scope_level--;
     }
 
+    void reset()
+    {
+        scope_level = -1;
+        top.clear();
+        bindings.clear();
+        scope_marks.clear();
+        loop_stack = {};
+        dims.clear();
+    }
+
     void enter_loop(koopa_raw_basic_block_data_t* loop_header, koopa_raw_basic_block_data_t* loop_exit)
     {
         loop_stack.push({loop_header, loop_exit});
@@ -68,10 +118,10 @@ namespace Symbol {
     }
     koopa_raw_basic_block_data_t* get_loop_header()
     {
-        return loop_stack.top().first;
+        return loop_stack.empty() ? nullptr : loop_stack.top().first;
     }
     koopa_raw_basic_block_data_t* get_loop_exit()
     {
-        return loop_stack.top().second;
+        return loop_stack.empty() ? nullptr : loop_stack.top().second;
     }
 };
\ No newline at end of file
@@ -5,6 +5,8 @@
 #include <memory>
 #include <vector>
 #include <koopa.h>
+#include "intern.h"
+#include "initlist.h"
 
 namespace Symbol {
     enum Type
@@ -22,24 +24,34 @@ namespace Symbol {
         koopa_raw_value_data_t* allocator;
         koopa_raw_function_data_t* function;
         std::vector<int>* dim_vec;
+        // 常量数组的内容, 其他的为 nullptr
+        const ConstArray* const_array;
     };
 
-    void insert(const std::string &ident, Type type, int int_value);
-    void insert(const std::string &ident, Type type, koopa_raw_value_data_t* allocator);
-    void insert(const std::string &ident, Type type, koopa_raw_function_data_t* function);
-    void insert(const std::string &ident, Type type, koopa_raw_value_data_t* allocator, std::vector<int>* dim_vec);
-    symbol_val query(const std::string &ident);
+    void insert(ident_id ident, Type type, int int_value);
+    void insert(ident_id ident, Type type, koopa_raw_value_data_t* allocator);
+    void insert(ident_id ident, Type type, koopa_raw_function_data_t* function);
+    // 数组维度的存放处, 由符号表持有, reset 时释放
+    std::vector<int>* new_dims();
+    void insert(ident_id ident, Type type, koopa_raw_value_data_t* allocator, std::vector<int>* dim_vec);
+    void insert(ident_id ident, Type type, koopa_raw_value_data_t* allocator, std::vector<int>* dim_vec, const ConstArray* const_array);
+    // 返回的引用在下一次 insert 或 leave_scope 之前有效
+    const symbol_val &query(ident_id ident);
+    bool exists(ident_id ident);
     void enter_scope();
     void leave_scope();
+    // 清空所有作用域, 编译出错中途退出后也能重新开始
+    void reset();
     void enter_loop(koopa_raw_basic_block_data_t* loop_header, koopa_raw_basic_block_data_t* loop_exit);
     void leave_loop();
+    // 不在循环里时返回 nullptr
     koopa_raw_basic_block_data_t* get_loop_header();
     koopa_raw_basic_block_data_t* get_loop_exit();
 };
 
 // namespace ConstSymbol {
-//     void insert(const std::string &ident, int int_value);
-//     int query(const std::string &ident);
+//     void insert(ident_id ident, int int_value);
+//     int query(ident_id ident);
 
 //     void enter_scope();
 //     void exit_scope();
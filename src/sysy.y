@@ -2,6 +2,13 @@
   #include <memory>
   #include <string>
   #include "ast.h"
+  #include "intern.h"
+
+  // 和 flex 生成的定义保持一致
+  #ifndef YY_TYPEDEF_YY_SCANNER_T
+  #define YY_TYPEDEF_YY_SCANNER_T
+  typedef void *yyscan_t;
+  #endif
 }
 
 %{
@@ -14,18 +21,26 @@
 #include "ast.h"
 #include "symtab.h"
 
-// 声明 lexer 函数和错误处理函数
-int yylex();
-void yyerror(std::unique_ptr<BaseAST> &ast, const char *s);
-
 using namespace std;
 
 %}
 
+%code {
+// 声明 lexer 函数和错误处理函数
+int yylex(YYSTYPE *yylval, yyscan_t scanner);
+int yyget_lineno(yyscan_t scanner);
+void yyerror(std::unique_ptr<BaseAST> &ast, yyscan_t scanner, std::string &error, const char *s);
+}
+
+// parser 和 lexer 都是可重入的, 状态全在 scanner 里, 没有全局的 yylval/yyin
+%define api.pure full
+%lex-param { yyscan_t scanner }
+
 // 定义 parser 函数和错误处理函数的附加参数
 // 我们需要返回一个字符串作为 AST, 所以我们把附加参数定义成字符串的智能指针
 // 解析完成后, 我们要手动修改这个参数, 把它设置成解析得到的字符串
-%parse-param { std::unique_ptr<BaseAST> &ast }
+// 出错时错误信息写到 error 里, 由调用者决定怎么报告
+%parse-param { std::unique_ptr<BaseAST> &ast } { yyscan_t scanner } { std::string &error }
 
 // yylval 的定义, 我们把它定义成了一个联合体 (union)
 // 因为 token 的值有的是字符串指针, 有的是整数
@@ -35,15 +50,19 @@ using namespace std;
 %union {
   std::string *str_val;
   int int_val;
+  ident_id ident_val;
+  koopa_raw_binary_op_t op_val;
   char char_val;
   BaseAST *ast_val;
   std::vector<std::unique_ptr<BaseAST>> *vec_val;
 }
 
 // lexer 返回的所有 token 种类的声明
-// 注意 IDENT 和 INT_CONST 会返回 token 的值, 分别对应 str_val 和 int_val
+// 注意 IDENT 和 INT_CONST 会返回 token 的值, 分别对应 ident_val 和 int_val
+// IDENT 只带驻留后的编号, RELOP 和 EQOP 直接带对应的二元运算符
 %token INT RETURN LAND LOR CONST IF ELSE WHILE BREAK CONTINUE VOID
-%token <str_val> IDENT RELOP EQOP
+%token <ident_val> IDENT
+%token <op_val> RELOP EQOP
 %token <int_val> INT_CONST
 
 // 非终结符的类型定义
@@ -62,12 +81,15 @@ using namespace std;
 %type <vec_val> DimList IndexList ConstDefList VarDefList ConstInitValList InitValList
 %type <vec_val> GlobalDefList FuncFParamList FuncRParamList BlockItemList
 
+// 语法错误中途退出时, 已经建好但还没有接到树上的部分由这里释放
+%destructor { delete $$; } <ast_val> <vec_val> <str_val>
+
 %%
 
 CompUnit
   : GlobalDefList {
     auto comp_unit = make_unique<CompUnitAST>();
-    comp_unit->global_def_list = $1;
+    comp_unit->global_def_list.reset($1);
     ast = move(comp_unit);
   }
   ;
@@ -102,8 +124,8 @@ FuncDef
   : Type IDENT '(' FuncFParamList ')' Block {
     auto ast = new FuncDefAST();
     ast->func_type = *unique_ptr<string>($1);
-    ast->ident = *unique_ptr<string>($2);
-    ast->func_f_param_list = $4;
+    ast->ident = $2;
+    ast->func_f_param_list.reset($4);
     ast->block = unique_ptr<BaseAST>($6);
     $$ = ast;
   }
@@ -128,30 +150,30 @@ FuncFParam
   : Type IDENT {
     auto ast = new FuncFParamAST();
     ast->type = *unique_ptr<string>($1);
-    ast->ident = *unique_ptr<string>($2);
+    ast->ident = $2;
     ast->is_array = false;
     $$ = ast;
   }
   | Type IDENT '[' ']' {
     auto ast = new FuncFParamAST();
     ast->type = *unique_ptr<string>($1);
-    ast->ident = *unique_ptr<string>($2);
+    ast->ident = $2;
     ast->is_array = true;
     $$ = ast;
   }
   | Type IDENT '[' ']' DimList {
     auto ast = new FuncFParamAST();
     ast->type = *unique_ptr<string>($1);
-    ast->ident = *unique_ptr<string>($2);
+    ast->ident = $2;
     ast->is_array = true;
-    ast->dim_list = $5;
+    ast->dim_list.reset($5);
     $$ = ast;
   }
 
 Block
   : '{' BlockItemList '}' {
     auto ast = new BlockAST();
-    ast->block_item_list = $2;
+    ast->block_item_list.reset($2);
     $$ = ast;
   }
   ;
@@ -415,8 +437,8 @@ UnaryExp
   | IDENT '(' FuncRParamList ')' {
     auto ast = new UnaryExpAST();
     ast->type = UnaryExpAST::FUNC_CALL;
-    ast->ident = *unique_ptr<string>($1);
-    ast->func_r_param_list = $3;
+    ast->ident = $1;
+    ast->func_r_param_list.reset($3);
     $$ = ast;
   }
   ;
@@ -484,7 +506,7 @@ RelExp
     auto ast = new RelExpAST();
     ast->type = RelExpAST::REL;
     ast->rel_exp = unique_ptr<BaseAST>($1);
-    ast->op = *unique_ptr<std::string>($2);
+    ast->op = $2;
     ast->add_exp = unique_ptr<BaseAST>($3);
     $$ = ast;
   }
@@ -501,7 +523,7 @@ EqExp
     auto ast = new EqExpAST();
     ast->type = EqExpAST::EQ;
     ast->eq_exp = unique_ptr<BaseAST>($1);
-    ast->op = *unique_ptr<std::string>($2);
+    ast->op = $2;
     ast->rel_exp = unique_ptr<BaseAST>($3);
     $$ = ast;
   }
@@ -557,8 +579,8 @@ Decl
 ConstDecl
   : CONST Type ConstDefList ';' {
     auto ast = new ConstDeclAST();
-    ast->btype = *$2;
-    ast->const_def_list = $3;
+    ast->btype = *unique_ptr<string>($2);
+    ast->const_def_list.reset($3);
     $$ = ast;
   }
   ;
@@ -566,8 +588,8 @@ ConstDecl
 VarDecl
   : Type VarDefList ';' {
     auto ast = new VarDeclAST();
-    ast->btype = *$1;
-    ast->var_def_list = $2;
+    ast->btype = *unique_ptr<string>($1);
+    ast->var_def_list.reset($2);
     $$ = ast;
   }
   ;
@@ -643,14 +665,14 @@ Type
 ConstDef
   : IDENT '=' ConstInitVal {
     auto ast = new ConstDefAST();
-    ast->ident = *unique_ptr<std::string>($1);
+    ast->ident = $1;
     ast->const_init_val = unique_ptr<BaseAST>($3);
     $$ = ast;
   }
   | IDENT DimList '=' ConstInitVal {
     auto ast = new ConstDefAST();
-    ast->ident = *unique_ptr<std::string>($1);
-    ast->dim_list = $2;
+    ast->ident = $1;
+    ast->dim_list.reset($2);
     ast->const_init_val = unique_ptr<BaseAST>($4);
     $$ = ast;
   }
@@ -660,28 +682,28 @@ VarDef
   : IDENT {
     auto ast = new VarDefAST();
     ast->has_init_val = false;
-    ast->ident = *unique_ptr<std::string>($1);
+    ast->ident = $1;
     $$ = ast;
   }
   | IDENT DimList {
     auto ast = new VarDefAST();
     ast->has_init_val = false;
-    ast->ident = *unique_ptr<std::string>($1);
-    ast->dim_list = $2;
+    ast->ident = $1;
+    ast->dim_list.reset($2);
     $$ = ast;
   }
   | IDENT '=' InitVal {
     auto ast = new VarDefAST();
     ast->has_init_val = true;
-    ast->ident = *unique_ptr<std::string>($1);
+    ast->ident = $1;
     ast->init_val = unique_ptr<BaseAST>($3);
     $$ = ast;
   }
   | IDENT DimList '=' InitVal {
     auto ast = new VarDefAST();
     ast->has_init_val = true;
-    ast->ident = *unique_ptr<std::string>($1);
-    ast->dim_list = $2;
+    ast->ident = $1;
+    ast->dim_list.reset($2);
     ast->init_val = unique_ptr<BaseAST>($4);
     $$ = ast;
   }
@@ -697,7 +719,7 @@ ConstInitVal
   | '{' ConstInitValList '}' {
     auto ast = new ConstInitValAST();
     ast->is_list = true;
-    ast->const_init_val_list = $2;
+    ast->const_init_val_list.reset($2);
     $$ = ast;
   } 
   ;
@@ -712,28 +734,28 @@ InitVal
   | '{' InitValList '}' {
     auto ast = new InitValAST();
     ast->is_list = true;
-    ast->init_val_list = $2;
+    ast->init_val_list.reset($2);
     $$ = ast;
   }
 
 LVal
   : IDENT {
     auto ast = new LValAST();
-    ast->ident = *unique_ptr<std::string>($1);
+    ast->ident = $1;
     $$ = ast;
   }
   | IDENT IndexList {
     auto ast = new LValAST();
-    ast->ident = *unique_ptr<std::string>($1);
-    ast->index_list = $2;
+    ast->ident = $1;
+    ast->index_list.reset($2);
     $$ = ast;
   }
   ;
 
 %%
 
-// 定义错误处理函数, 其中第二个参数是错误信息
+// 定义错误处理函数, 其中最后一个参数是错误信息
 // parser 如果发生错误 (例如输入的程序出现了语法错误), 就会调用这个函数
-void yyerror(unique_ptr<BaseAST> &ast, const char *s) {
-  cerr << "error: " << s << endl;
+void yyerror(unique_ptr<BaseAST> &ast, yyscan_t scanner, string &error, const char *s) {
+  error = "line " + to_string(yyget_lineno(scanner)) + ": " + s;
 }
@@ -0,0 +1,148 @@
+#include "timing.h"
+#include <chrono>
+#include <cstring>
+#include <sys/resource.h>
+#include <vector>
+#include "arena.h"
+
+namespace Timing {
+    struct Record {
+        const char *name;
+        double start_us;
+        double duration_us;
+        size_t allocs;
+        size_t bytes;
+        long peak_rss_kb;
+    };
+
+    struct Counter {
+        const char *name;
+        size_t value;
+        double time_us;
+    };
+
+    struct State {
+        bool on = false;
+        std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+        std::vector<Record> records;
+        std::vector<Counter> counters;
+    };
+    static thread_local State state;
+
+    static double now_us()
+    {
+        return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - state.epoch).count();
+    }
+
+    // 整个进程的峰值 RSS, Linux 上单位是 KB
+    static long peak_rss_kb()
+    {
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_maxrss;
+    }
+
+    void enable(bool on)
+    {
+        state.on = on;
+    }
+
+    bool enabled()
+    {
+        return state.on;
+    }
+
+    Scope::Scope(const char *name) : name(name)
+    {
+        if (!state.on)
+            return;
+        start_us = now_us();
+        start_allocs = ir_arena.allocation_count();
+        start_bytes = ir_arena.bytes_allocated();
+    }
+
+    Scope::~Scope()
+    {
+        if (!state.on)
+            return;
+        // arena 在阶段中间被 release 时计数会归零, 这时只记结束时的值
+        size_t allocs = ir_arena.allocation_count();
+        size_t bytes = ir_arena.bytes_allocated();
+        state.records.push_back({
+            name,
+            start_us,
+            now_us() - start_us,
+            allocs >= start_allocs ? allocs - start_allocs : allocs,
+            bytes >= start_bytes ? bytes - start_bytes : bytes,
+            peak_rss_kb(),
+        });
+    }
+
+    void set_counter(const char *name, size_t value)
+    {
+        if (!state.on)
+            return;
+        for (auto &counter : state.counters) {
+            if (strcmp(counter.name, name) == 0) {
+                counter.value = value;
+                counter.time_us = now_us();
+                return;
+            }
+        }
+        state.counters.push_back({name, value, now_us()});
+    }
+
+    void print_table(FILE *fp)
+    {
+        double total = 0;
+        for (auto &record : state.records)
+            total += record.duration_us;
+        fprintf(fp, "===-------------------------------------------------------------===\n");
+        fprintf(fp, "                     Compile phase report\n");
+        fprintf(fp, "===-------------------------------------------------------------===\n");
+        fprintf(fp, "%12s %7s %10s %12s %10s  %s\n", "wall (ms)", "%", "allocs", "bytes", "peak RSS", "phase");
+        for (auto &record : state.records) {
+            fprintf(fp, "%12.3f %6.1f%% %10zu %12zu %7ld KB  %s\n",
+                record.duration_us / 1000, total > 0 ? record.duration_us * 100 / total : 0.0,
+                record.allocs, record.bytes, record.peak_rss_kb, record.name);
+        }
+        fprintf(fp, "%12.3f %6.1f%% %10s %12s %10s  %s\n", total / 1000, 100.0, "", "", "", "total");
+        if (!state.counters.empty()) {
+            fprintf(fp, "\n");
+            for (auto &counter : state.counters)
+                fprintf(fp, "%12zu  %s\n", counter.value, counter.name);
+        }
+    }
+
+    bool write_trace(const char *path)
+    {
+        FILE *fp = fopen(path, "w");
+        if (fp == nullptr)
+            return false;
+        // 阶段名都是代码里的常量, 不需要转义
+        fprintf(fp, "{\"traceEvents\":[\n");
+        bool first = true;
+        for (auto &record : state.records) {
+            fprintf(fp, "%s{\"name\":\"%s\",\"cat\":\"phase\",\"ph\":\"X\",\"pid\":1,\"tid\":1,"
+                "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"allocs\":%zu,\"bytes\":%zu,\"peak_rss_kb\":%ld}}",
+                first ? "" : ",\n", record.name, record.start_us, record.duration_us,
+                record.allocs, record.bytes, record.peak_rss_kb);
+            first = false;
+        }
+        for (auto &counter : state.counters) {
+            fprintf(fp, "%s{\"name\":\"%s\",\"cat\":\"ir\",\"ph\":\"C\",\"pid\":1,\"tid\":1,"
+                "\"ts\":%.3f,\"args\":{\"value\":%zu}}",
+                first ? "" : ",\n", counter.name, counter.time_us, counter.value);
+            first = false;
+        }
+        fprintf(fp, "\n],\"displayTimeUnit\":\"ms\"}\n");
+        return fclose(fp) == 0;
+    }
+
+    void reset()
+    {
+        state.records.clear();
+        state.counters.clear();
+        state.epoch = std::chrono::steady_clock::now();
+    }
+}
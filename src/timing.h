@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdio>
+#include <string>
+
+// 编译各阶段的耗时和内存统计, 用于 -time-passes 和 -trace
+// 记录是线程局部的, 没有 enable 时 Scope 什么都不做
+namespace Timing {
+    void enable(bool on);
+    bool enabled();
+
+    // 在作用域内统计一个阶段: 墙钟时间, ir_arena 上的分配次数和字节数, 结束时的峰值 RSS
+    // name 必须是字符串常量
+    class Scope
+    {
+    public:
+        explicit Scope(const char *name);
+        ~Scope();
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        const char *name;
+        double start_us;
+        size_t start_allocs;
+        size_t start_bytes;
+    };
+
+    // IR 规模之类的计数器, 同名的后一次覆盖前一次
+    void set_counter(const char *name, size_t value);
+
+    // 人看的表格
+    void print_table(FILE *fp);
+    // Chrome trace event 格式 (chrome://tracing 或 Perfetto 可以打开)
+    bool write_trace(const char *path);
+
+    // 清空已有的记录, 时间重新从 0 开始
+    void reset();
+}
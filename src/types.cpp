@@ -0,0 +1,169 @@
+#include "types.h"
+#include "arena.h"
+#include <functional>
+#include <unordered_map>
+
+namespace RawType {
+    // 驻留的节点, kind 必须放在第一个, 这样 koopa_raw_type_t 可以直接转回 Node
+    struct Node {
+        koopa_raw_type_kind_t kind;
+        size_t words;
+    };
+
+    struct ArrayKey {
+        koopa_raw_type_t base;
+        size_t len;
+        bool operator==(const ArrayKey& other) const { return base == other.base && len == other.len; }
+    };
+
+    // 子类型都已经驻留过, 所以哈希和比较只看指针
+    struct KeyHash {
+        size_t operator()(const ArrayKey& key) const
+        {
+            return std::hash<const void*>()(key.base) * 31 + key.len;
+        }
+        size_t operator()(const std::vector<koopa_raw_type_t>& key) const
+        {
+            size_t h = key.size();
+            for (auto t : key)
+                h = h * 31 + std::hash<const void*>()(t);
+            return h;
+        }
+    };
+
+    // 每个线程一张表, 节点放在 ir_arena 里, 每次编译开始时 reset
+    struct Table {
+        koopa_raw_type_t i32 = nullptr;
+        koopa_raw_type_t unit = nullptr;
+        std::unordered_map<koopa_raw_type_t, koopa_raw_type_t> pointers;
+        std::unordered_map<ArrayKey, koopa_raw_type_t, KeyHash> arrays;
+        // 键是参数类型后面再接上返回类型
+        std::unordered_map<std::vector<koopa_raw_type_t>, koopa_raw_type_t, KeyHash> functions;
+    };
+    static thread_local Table table;
+
+    static koopa_raw_type_t make_node(const koopa_raw_type_kind_t& kind, size_t words)
+    {
+        return &ir_arena.make<Node>({kind, words})->kind;
+    }
+
+    koopa_raw_type_t i32()
+    {
+        if (table.i32 == nullptr)
+            table.i32 = make_node({.tag = KOOPA_RTT_INT32}, 1);
+        return table.i32;
+    }
+
+    koopa_raw_type_t unit()
+    {
+        if (table.unit == nullptr)
+            table.unit = make_node({.tag = KOOPA_RTT_UNIT}, 0);
+        return table.unit;
+    }
+
+    koopa_raw_type_t array(koopa_raw_type_t base, size_t len)
+    {
+        auto& ty = table.arrays[{base, len}];
+        if (ty == nullptr) {
+            ty = make_node({
+                .tag = KOOPA_RTT_ARRAY,
+                .data = {
+                    .array = {
+                        .base = base,
+                        .len = len,
+                    },
+                },
+            }, word_count(base) * len);
+        }
+        return ty;
+    }
+
+    koopa_raw_type_t pointer(koopa_raw_type_t base)
+    {
+        auto& ty = table.pointers[base];
+        if (ty == nullptr) {
+            ty = make_node({
+                .tag = KOOPA_RTT_POINTER,
+                .data = {
+                    .pointer = {
+                        .base = base,
+                    },
+                },
+            }, 1);
+        }
+        return ty;
+    }
+
+    koopa_raw_type_t function(const std::vector<koopa_raw_type_t>& params, koopa_raw_type_t ret)
+    {
+        auto key = params;
+        key.push_back(ret);
+        auto& ty = table.functions[key];
+        if (ty == nullptr) {
+            auto buffer = ir_arena.make_array<const void*>(params.size());
+            for (size_t i = 0; i < params.size(); i++)
+                buffer[i] = params[i];
+            ty = make_node({
+                .tag = KOOPA_RTT_FUNCTION,
+                .data = {
+                    .function = {
+                        .params = {
+                            .buffer = buffer,
+                            .len = (uint32_t)params.size(),
+                            .kind = KOOPA_RSIK_TYPE,
+                        },
+                        .ret = ret,
+                    },
+                },
+            }, 0);
+        }
+        return ty;
+    }
+
+    // 只有这里建立的节点后面带着 words, 别的类型 (比如 -test 模式里 libkoopa 建的) 不能转成 Node
+    static bool interned(koopa_raw_type_t t)
+    {
+        switch (t->tag) {
+            case KOOPA_RTT_INT32:
+                return t == table.i32;
+            case KOOPA_RTT_UNIT:
+                return t == table.unit;
+            case KOOPA_RTT_ARRAY: {
+                auto it = table.arrays.find({t->data.array.base, t->data.array.len});
+                return it != table.arrays.end() && it->second == t;
+            }
+            case KOOPA_RTT_POINTER: {
+                auto it = table.pointers.find(t->data.pointer.base);
+                return it != table.pointers.end() && it->second == t;
+            }
+            default:
+                return false;
+        }
+    }
+
+    size_t word_count(koopa_raw_type_t t)
+    {
+        if (interned(t))
+            return ((const Node*)t)->words;
+        switch (t->tag) {
+            case KOOPA_RTT_INT32:
+            case KOOPA_RTT_POINTER:
+                return 1;
+            case KOOPA_RTT_ARRAY:
+                return t->data.array.len * word_count(t->data.array.base);
+            default:
+                return 0;
+        }
+    }
+
+    size_t size()
+    {
+        return (table.i32 != nullptr) + (table.unit != nullptr)
+            + table.pointers.size() + table.arrays.size() + table.functions.size();
+    }
+
+    void reset()
+    {
+        table = Table();
+    }
+}
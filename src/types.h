@@ -0,0 +1,25 @@
+#pragma once
+
+#include <vector>
+#include "koopa.h"
+
+// 类型驻留表: 结构相同的类型只有一个节点
+// 所以判断两个类型是否相同直接比较指针即可
+// 返回的节点不能修改, 和其他 IR 一样分配在 ir_arena 里, 生命周期为一次编译
+namespace RawType {
+    koopa_raw_type_t i32();
+    koopa_raw_type_t unit();
+    koopa_raw_type_t array(koopa_raw_type_t base, size_t len);
+    koopa_raw_type_t pointer(koopa_raw_type_t base);
+    koopa_raw_type_t function(const std::vector<koopa_raw_type_t>& params, koopa_raw_type_t ret);
+
+    // 类型占多少个 4 字节的字, 驻留的类型在建立节点时就算好了
+    // 不是从这里拿到的类型 (libkoopa 建的) 递归计算
+    size_t word_count(koopa_raw_type_t t);
+
+    // 已经建立的类型节点个数
+    size_t size();
+
+    // 清空驻留表, 在 ir_arena 释放前后调用
+    void reset();
+}
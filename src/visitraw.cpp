@@ -1,207 +1,344 @@
 #include "visitraw.h"
-#include <iostream>
+#include "types.h"
+#include "regalloc.h"
+#include "peephole.h"
 #include <cassert>
 #include <string>
 #include <cmath>
 #include <cstring>
-#include <map>
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+// 后端的状态都是每个线程一份
+thread_local AsmWriter asm_out;
+
+// 当前函数的寄存器分配结果
+static thread_local RegAlloc::Result allocation;
+// 正在生成的基本块
+static thread_local koopa_raw_basic_block_t current_bb;
+
+// 装载常量, 溢出的值, alloc/全局变量地址用的临时寄存器, t6 另外留给大偏移
+// 并行赋值拆环时 scratch1 暂存被覆盖的值
+static const char* const scratch0 = "t4";
+static const char* const scratch1 = "t5";
 
 namespace Stack {
-    int R;
-    static std::map<koopa_raw_value_t, int> loc_map;
-    static int current_loc;
-    static int stack_frame_length;
+    // 栈帧从 sp 往上依次是: 第 8 个以后的调用参数, 溢出的值, alloc 的变量, 保存的 s 寄存器, ra
+    thread_local int R;
+    static thread_local std::unordered_map<koopa_raw_value_t, int> loc_map;
+    static thread_local int spill_base;
+    static thread_local int saved_base;
+    static thread_local int stack_frame_length;
     int Query(koopa_raw_value_t inst) {
-        return loc_map[inst];
+        auto it = allocation.locations.find(inst);
+        if (it != allocation.locations.end()) {
+            assert(it->second.reg == -1);
+            return spill_base + 4 * it->second.slot;
+        }
+        return loc_map.at(inst);
     }
     void Insert(koopa_raw_value_t inst, int loc) {
         loc_map.insert({inst, loc});
     }
-    void Load2reg(koopa_raw_value_t value, std::string reg) {
+    void Load2reg(koopa_raw_value_t value, const char* reg) {
         switch (value->kind.tag) {
             case KOOPA_RVT_INTEGER:
-                std::cout << "  li " << reg << ", " << value->kind.data.integer.value << std::endl;
-                break;
-            case KOOPA_RVT_BLOCK_ARG_REF:
-                std::cout << "  mv " << reg << ", a" << value->kind.data.block_arg_ref.index << std::endl;
-                break;
-            case KOOPA_RVT_FUNC_ARG_REF:
-                if (value->kind.data.func_arg_ref.index < 8) {
-                    std::cout << "  mv " << reg << ", a" << value->kind.data.func_arg_ref.index << std::endl;
-                } else {
-                    lw_safe(reg, 4 * (value->kind.data.func_arg_ref.index - 8) + stack_frame_length);
-                }
+                asm_out << "  li " << reg << ", " << value->kind.data.integer.value << '\n';
                 break;
             case KOOPA_RVT_GLOBAL_ALLOC:
-                std::cout << "  la " << reg << ", " << value->name + 1 << std::endl;
+                asm_out << "  la " << reg << ", " << value->name + 1 << '\n';
                 break;
             case KOOPA_RVT_ALLOC:
             {
                 int pos = Query(value);
                 if (pos < 2048) {
-                    std::cout << "  addi " << reg << ", sp, " << pos << std::endl;
+                    asm_out << "  addi " << reg << ", sp, " << pos << '\n';
                 } else {
-                    std::cout << "  li " << reg << ", " << pos << std::endl;
-                    std::cout << "  add " << reg << ", " << reg << ", sp" << std::endl;
+                    asm_out << "  li " << reg << ", " << pos << '\n';
+                    asm_out << "  add " << reg << ", " << reg << ", sp" << '\n';
                 }
                 break;
             }
-            default: // 剩下的都是在栈上的指令
-                lw_safe(reg, Query(value));
+            default: // 剩下的都分配了寄存器或者溢出到了栈上
+            {
+                auto loc = allocation.locations.at(value);
+                if (loc.reg == -1)
+                    lw_safe(reg, Query(value));
+                else if (strcmp(RegAlloc::name(loc.reg), reg) != 0)
+                    asm_out << "  mv " << reg << ", " << RegAlloc::name(loc.reg) << '\n';
+            }
         }
     }
 }
 
-const int n_regs = 6;
+// 读操作数: 分到了寄存器就直接用, 否则装进 scratch
+static const char* use_reg(koopa_raw_value_t value, const char* scratch)
+{
+    auto it = allocation.locations.find(value);
+    if (it != allocation.locations.end() && it->second.reg != -1)
+        return RegAlloc::name(it->second.reg);
+    Stack::Load2reg(value, scratch);
+    return scratch;
+}
 
-struct Reg_info {
-    bool active = false;
-    int life = 0;
-    koopa_raw_value_t inst = nullptr;
-    bool used = false;
-    // bool operator>(const Reg_info &rhs) const {
-    //     bool lhs_will_be_used = (inst->used_by.len > 0 && !used) || inst->kind.tag == KOOPA_RVT_ALLOC || inst->kind.tag == KOOPA_RVT_GET_ELEM_PTR;
-    //     bool rhs_will_be_used = (rhs.inst->used_by.len > 0 && !rhs.used) || rhs.inst->kind.tag == KOOPA_RVT_ALLOC || rhs.inst->kind.tag == KOOPA_RVT_GET_ELEM_PTR;
-    //     if (!lhs_will_be_used)
-    //         return true;
-    //     if (!rhs_will_be_used)
-    //         return false;
-    //     return life > rhs.life;
-    // }
-} reg_info[n_regs];
+// 写结果的寄存器, 溢出的或者没人用的结果先写到 scratch0
+static const char* def_reg(koopa_raw_value_t value)
+{
+    auto it = allocation.locations.find(value);
+    if (it != allocation.locations.end() && it->second.reg != -1)
+        return RegAlloc::name(it->second.reg);
+    return scratch0;
+}
 
-std::map<koopa_raw_value_t, int> reg_map;
+// 结果写进 reg 之后, 溢出的值存回栈上
+static void finish_def(koopa_raw_value_t value, const char* reg)
+{
+    auto it = allocation.locations.find(value);
+    if (it != allocation.locations.end() && it->second.reg == -1)
+        sw_safe(reg, Stack::Query(value));
+}
 
-void check_used_inst(koopa_raw_value_t inst)
+// 从 reg (a0) 里接收结果
+static void receive(koopa_raw_value_t value, const char* reg)
 {
-    if (inst->kind.tag == KOOPA_RVT_ALLOC || inst->kind.tag == KOOPA_RVT_GET_ELEM_PTR)
+    auto it = allocation.locations.find(value);
+    if (it == allocation.locations.end())
         return;
-    if (inst->used_by.len == 0 || reg_info[reg_map[inst]].used) {
-        reg_info[reg_map[inst]].active = false;
-        reg_map.erase(inst);
-    }
-}
-
-std::string distribute_reg(koopa_raw_value_t inst, bool use=true) {
-    for (int i = 0; i < n_regs; i++)
-        if (reg_info[i].active)
-            reg_info[i].life++;
-    // 已经加载到寄存器中了
-    if (reg_map.find(inst) != reg_map.end()) {
-        int index = reg_map[inst];
-        reg_info[index].life = 0;
-        reg_info[index].used = use;
-        std::string reg = num2reg(index);
-        // std::clog << "Used " << reg << std::endl;
-        return reg;
-    }
-    // 寄存器还有空位
-    for (int i = 0; i < n_regs; i++) {
-        if (!reg_info[i].active) {
-            reg_info[i].active = true;
-            reg_info[i].life = 0;
-            reg_info[i].inst = inst;
-            reg_info[i].used = use;
-            reg_map[inst] = i;
-            std::string reg = num2reg(i);
-            if (use)
-                Stack::Load2reg(inst, reg);
-            // std::clog << "Allocated " << reg << " for inst " << ((inst->name == nullptr) ? std::to_string((long)(inst)) : inst->name) << std::endl;
-            return reg;
-        }
+    if (it->second.reg != -1)
+        asm_out << "  mv " << RegAlloc::name(it->second.reg) << ", " << reg << '\n';
+    else
+        sw_safe(reg, Stack::Query(value));
+}
+
+// load/store 的地址操作数, alloc 出来的变量直接用 sp 加偏移寻址
+static std::string mem_operand(koopa_raw_value_t ptr, const char* scratch)
+{
+    if (ptr->kind.tag == KOOPA_RVT_ALLOC) {
+        int pos = Stack::Query(ptr);
+        if (pos < 2048)
+            return std::to_string(pos) + "(sp)";
     }
-    // 寄存器没有空位，需要选择一个寄存器替换，策略LRU
-    int max_life = -1;
-    int spilt_index = -1;
-    for (int i = 0; i < n_regs; i++) {
-        if (reg_info[i].life > max_life) {
-            max_life = reg_info[i].life;
-            spilt_index = i;
-        }
+    return std::string("0(") + use_reg(ptr, scratch) + ")";
+}
+
+// 并行赋值: 函数入口接收参数, 调用传参, 跳转时给基本块参数赋值
+// 所有赋值同时发生, 按依赖排好顺序, 成环的时候先把环上一个位置的旧值挪到 scratch1
+namespace ParallelMove {
+    // 位置编号: [0, N_REGS) 是寄存器, STACK 往上是栈上的偏移, TEMP 是 scratch1
+    // NONE 表示源是常量/地址, 现场生成
+    const int NONE = -1;
+    const int TEMP = -2;
+    const int STACK = RegAlloc::N_REGS;
+
+    struct Move {
+        int dst;
+        int src;
+        koopa_raw_value_t value;
+    };
+
+    static thread_local std::vector<Move> moves;
+
+    // 值所在的位置, 没有分配位置的是常量/alloc/全局变量
+    static int location_of(koopa_raw_value_t value)
+    {
+        auto it = allocation.locations.find(value);
+        if (it == allocation.locations.end())
+            return NONE;
+        if (it->second.reg != -1)
+            return it->second.reg;
+        return STACK + Stack::Query(value);
     }
 
-    auto spilt_inst = reg_info[spilt_index].inst;
-    reg_map.erase(spilt_inst);
+    static const char* reg_name(int loc)
+    {
+        return loc == TEMP ? scratch1 : RegAlloc::name(loc);
+    }
 
-    switch (spilt_inst->kind.tag) {
-        case KOOPA_RVT_ALLOC:
-            break;
-        case KOOPA_RVT_GET_ELEM_PTR:
-            sw_safe(num2reg(spilt_index), Stack::Query(spilt_inst));
-            break;
-        default:
-            if (!reg_info[spilt_index].used && spilt_inst->used_by.len > 0) {
-                std::string reg = num2reg(spilt_index);
-                sw_safe(reg, Stack::Query(spilt_inst));
-            }
+    void add(int dst, koopa_raw_value_t value)
+    {
+        moves.push_back({dst, location_of(value), value});
     }
 
-    reg_info[spilt_index].active = true;
-    reg_info[spilt_index].life = 0;
-    reg_info[spilt_index].inst = inst;
-    reg_info[spilt_index].used = use;
-    reg_map[inst] = spilt_index;
-    std::string reg = num2reg(spilt_index);
-    if (use)
-        Stack::Load2reg(inst, reg);
-    // std::clog << "Allocated " << reg << " for inst " << ((inst->name == nullptr) ? std::to_string((long)(inst)) : inst->name) << std::endl;
-    return reg;
-}
+    void add(int dst, int src)
+    {
+        moves.push_back({dst, src, nullptr});
+    }
 
-inline std::string num2reg(int n) {
-    if ((n >= 0) && (n < 7)) {
-        return "t" + std::to_string(n);
+    // 目标是值分配到的位置, 没有分配位置的值 (没人用) 不用赋值
+    void add_to(koopa_raw_value_t dst, koopa_raw_value_t value)
+    {
+        int loc = location_of(dst);
+        if (loc != NONE)
+            add(loc, value);
     }
-    assert(false);
-}
 
-void clear_reg_info() {
-    for (int i = 0; i < n_regs; i++) {
-        if (reg_info[i].active && !reg_info[i].used && reg_info[i].inst->used_by.len > 0 && reg_info[i].inst->kind.tag != KOOPA_RVT_ALLOC) {
-            std::string reg = num2reg(i);
-            sw_safe(reg, Stack::Query(reg_info[i].inst));
+    static void emit(const Move &move)
+    {
+        bool dst_reg = move.dst < STACK;
+        if (move.src == NONE) {
+            const char* reg = dst_reg ? reg_name(move.dst) : scratch0;
+            Stack::Load2reg(move.value, reg);
+            if (!dst_reg)
+                sw_safe(reg, move.dst - STACK);
+        } else if (move.src < STACK) {
+            if (dst_reg)
+                asm_out << "  mv " << reg_name(move.dst) << ", " << reg_name(move.src) << '\n';
+            else
+                sw_safe(reg_name(move.src), move.dst - STACK);
+        } else {
+            const char* reg = dst_reg ? reg_name(move.dst) : scratch0;
+            lw_safe(reg, move.src - STACK);
+            if (!dst_reg)
+                sw_safe(reg, move.dst - STACK);
+        }
+    }
+
+    // 生成之前 add 的所有赋值
+    void flush()
+    {
+        std::vector<Move> pending;
+        for (auto &move : moves)
+            if (move.src != move.dst)
+                pending.push_back(move);
+        moves.clear();
+
+        // 每个位置还有几个赋值要读它, 读完了才能覆盖
+        std::unordered_map<int, int> readers;
+        std::unordered_map<int, std::vector<size_t>> read_by;
+        std::unordered_map<int, size_t> writer;
+        for (size_t i = 0; i < pending.size(); i++) {
+            if (pending[i].src != NONE) {
+                readers[pending[i].src]++;
+                read_by[pending[i].src].push_back(i);
+            }
+            writer[pending[i].dst] = i;
+        }
+        std::vector<size_t> ready;
+        for (size_t i = 0; i < pending.size(); i++)
+            if (readers[pending[i].dst] == 0)
+                ready.push_back(i);
+
+        std::vector<bool> done(pending.size(), false);
+        size_t n_done = 0;
+        size_t next = 0;
+        while (n_done < pending.size()) {
+            if (ready.empty()) {
+                // 剩下的都在环上: 目标位置的旧值挪到 TEMP, 读它的改成读 TEMP
+                while (done[next])
+                    next++;
+                int loc = pending[next].dst;
+                emit({TEMP, loc, nullptr});
+                for (auto i : read_by[loc])
+                    if (!done[i])
+                        pending[i].src = TEMP;
+                readers[loc] = 0;
+                ready.push_back(next);
+            }
+            size_t i = ready.back();
+            ready.pop_back();
+            emit(pending[i]);
+            done[i] = true;
+            n_done++;
+            int src = pending[i].src;
+            if (src != NONE && src != TEMP && --readers[src] == 0) {
+                auto it = writer.find(src);
+                if (it != writer.end() && !done[it->second])
+                    ready.push_back(it->second);
+            }
         }
-        reg_info[i].active = false;
-        reg_info[i].life = 0;
-        reg_info[i].inst = nullptr;
-        reg_info[i].used = false;
     }
-    reg_map.clear();
 }
 
-void lw_safe(std::string reg, int loc) { // 从栈上加载到寄存器
+// 跳转时给目标块的参数赋值
+static void pass_block_args(const koopa_raw_slice_t &args, koopa_raw_basic_block_t target)
+{
+    assert(args.len == target->params.len);
+    for (uint32_t i = 0; i < args.len; i++)
+        ParallelMove::add_to((koopa_raw_value_t)target->params.buffer[i], (koopa_raw_value_t)args.buffer[i]);
+    ParallelMove::flush();
+}
+
+static void adjust_sp(int delta)
+{
+    if (delta == 0)
+        return;
+    if (delta >= -2048 && delta < 2048)
+        asm_out << "  addi sp, sp, " << delta << '\n';
+    else {
+        asm_out << "  li t6, " << delta << '\n';
+        asm_out << "  add sp, sp, t6" << '\n';
+    }
+}
+
+void lw_safe(const char* reg, int loc) { // 从栈上加载到寄存器
     if (loc < 2048) {
-        std::cout << "  lw " << reg << ", " << loc << "(sp)" << std::endl;
+        asm_out << "  lw " << reg << ", " << loc << "(sp)" << '\n';
     } else {
-        std::cout << "  li t6, " << loc << std::endl;
-        std::cout << "  add t6, t6, sp" << std::endl;
-        std::cout << "  lw " << reg << ", 0(t6)" << std::endl;
+        asm_out << "  li t6, " << loc << '\n';
+        asm_out << "  add t6, t6, sp" << '\n';
+        asm_out << "  lw " << reg << ", 0(t6)" << '\n';
     }
 }
 
-void sw_safe(std::string reg, int loc) {
+void sw_safe(const char* reg, int loc) {
     if (loc < 2048) {
-        std::cout << "  sw " << reg << ", " << loc << "(sp)" << std::endl;
+        asm_out << "  sw " << reg << ", " << loc << "(sp)" << '\n';
     } else {
-        std::cout << "  li t6, " << loc << std::endl;
-        std::cout << "  add t6, t6, sp" << std::endl;
-        std::cout << "  sw " << reg << ", 0(t6)" << std::endl;
+        asm_out << "  li t6, " << loc << '\n';
+        asm_out << "  add t6, t6, sp" << '\n';
+        asm_out << "  sw " << reg << ", 0(t6)" << '\n';
     }
 }
 
-int array_len(const koopa_raw_type_kind* t) {
-    switch (t->tag) {
-        case KOOPA_RTT_INT32:
-            return 1;
-        case KOOPA_RTT_ARRAY:
-            return t->data.array.len * array_len(t->data.array.base);
-        case KOOPA_RTT_POINTER:
-            return 1;
+// 驻留过的类型元素个数在建立类型时已经算好, -test 模式下 libkoopa 建的类型递归计算
+int array_len(koopa_raw_type_t t) {
+    assert(t->tag == KOOPA_RTT_INT32 || t->tag == KOOPA_RTT_ARRAY || t->tag == KOOPA_RTT_POINTER);
+    return RawType::word_count(t);
+}
+
+
+// 初值全是 0 的全局变量 (前端已经把全 0 的数组初值做成了 zeroinit)
+static bool is_zero_global(koopa_raw_value_t value)
+{
+    auto init = value->kind.data.global_alloc.init;
+    return init->kind.tag == KOOPA_RVT_ZERO_INIT
+        || (init->kind.tag == KOOPA_RVT_INTEGER && init->kind.data.integer.value == 0);
+}
+
+// 指针 ptr 指向的内存是否只会被读: 所有使用者都是 load, 或者是继续往下取地址的 getelemptr/getptr
+// 被 store 写入, 被当作值存起来或传给函数的都算可能被写
+static bool is_read_only(koopa_raw_value_t ptr)
+{
+    for (uint32_t i = 0; i < ptr->used_by.len; i++) {
+        auto user = (koopa_raw_value_t)ptr->used_by.buffer[i];
+        switch (user->kind.tag) {
+        case KOOPA_RVT_LOAD:
+            break;
+        case KOOPA_RVT_GET_ELEM_PTR:
+            if (user->kind.data.get_elem_ptr.src != ptr || !is_read_only(user))
+                return false;
+            break;
+        case KOOPA_RVT_GET_PTR:
+            if (user->kind.data.get_ptr.src != ptr || !is_read_only(user))
+                return false;
+            break;
         default:
-            assert(false);
+            return false;
+        }
     }
+    return true;
 }
 
+enum GlobalSection { SECTION_DATA, SECTION_RODATA, SECTION_BSS };
+
+static GlobalSection global_section(koopa_raw_value_t value)
+{
+    if (is_zero_global(value))
+        return SECTION_BSS;
+    // 常量数组和从来没被写过的全局变量都放进只读段
+    return is_read_only(value) ? SECTION_RODATA : SECTION_DATA;
+}
 
 // 访问 raw program
 void Visit(const koopa_raw_program_t &program)
@@ -212,11 +349,19 @@ void Visit(const koopa_raw_program_t &program)
     //     i = {nullptr, 0};
     // }
     // ...
-    // 访问所有全局变量
-    std::cout << "  .data" << std::endl;
-    Visit(program.values);
+    // 访问所有全局变量, 有非 0 初值的按是否会被写分到 .data 和 .rodata, 全 0 的放 .bss
+    // 没有被用到的全局变量 (比如只在编译期被读过的常量数组) 不输出
+    static const char* const section_names[] = {"  .data", "  .section .rodata", "  .bss"};
+    for (int section = SECTION_DATA; section <= SECTION_BSS; section++) {
+        asm_out << section_names[section] << '\n';
+        for (size_t i = 0; i < program.values.len; i++) {
+            auto value = (koopa_raw_value_t)program.values.buffer[i];
+            if (value->used_by.len != 0 && global_section(value) == section)
+                Visit(value);
+        }
+    }
     // 访问所有函数
-    std::cout << "  .text" << std::endl;
+    asm_out << "  .text" << '\n';
     Visit(program.funcs);
 }
 
@@ -254,13 +399,15 @@ void Visit(const koopa_raw_function_t &func)
 {
     if (func->bbs.len == 0)
         return;
+    size_t start = asm_out.size();
     // 执行一些其他的必要操作
     // ...
-    std::cout << "  .globl " << func->name + 1 << std::endl;
-    std::cout << func->name + 1 << ":" << std::endl;
+    asm_out << "  .globl " << func->name + 1 << '\n';
+    asm_out << func->name + 1 << ":" << '\n';
+
+    allocation = RegAlloc::Allocate(func);
 
     // 计算栈帧长度
-    int insts_on_stack = 0;
     bool has_call = false;
     int extra_args_in_call = 0;
     int total_alloc_len = 0;
@@ -279,55 +426,81 @@ void Visit(const koopa_raw_function_t &func)
             case KOOPA_RVT_CALL:
                 has_call = true;
                 extra_args_in_call = std::max(extra_args_in_call, (int)inst->kind.data.call.args.len - 8);
-            case KOOPA_RVT_BINARY:
-            case KOOPA_RVT_LOAD:
-            case KOOPA_RVT_GET_PTR:
-            case KOOPA_RVT_GET_ELEM_PTR:
-                if (inst->used_by.len > 0)
-                    insts_on_stack += 1;
                 break;
             default:
                 break;
             }
         }
     }
-    int S = insts_on_stack * 4;
-    Stack::R = has_call ? 4 : 0;
     int A = extra_args_in_call * 4;
+    int S = allocation.spill_slots * 4;
     int L = total_alloc_len * 4;
-    Stack::stack_frame_length = (S + Stack::R + A + L + 15) / 16 * 16;
-
-    Stack::loc_map = std::map<koopa_raw_value_t, int>();
+    int C = allocation.used_callee_saved.size() * 4;
+    Stack::R = has_call ? 4 : 0;
+    Stack::spill_base = A;
+    Stack::saved_base = A + S + L;
+    Stack::stack_frame_length = (A + S + L + C + Stack::R + 15) / 16 * 16;
 
-    if (Stack::stack_frame_length > 0) {
-        if (Stack::stack_frame_length < 2048)
-            std::cout << "  addi sp, sp, " << -Stack::stack_frame_length << std::endl;
-        else {
-            std::cout << "  li t6, " << -Stack::stack_frame_length << std::endl;
-            std::cout << "  add sp, sp, t6" << std::endl;
+    // alloc 的位置一开始就排好, 小的放前面, 让标量尽量能用 12 位的偏移直接寻址
+    std::vector<koopa_raw_value_t> allocs;
+    for (size_t i = 0; i < func->bbs.len; ++i) {
+        auto bb = (koopa_raw_basic_block_t)func->bbs.buffer[i];
+        for (size_t j = 0; j < bb->insts.len; ++j) {
+            auto inst = (koopa_raw_value_t)bb->insts.buffer[j];
+            if (inst->kind.tag == KOOPA_RVT_ALLOC && inst->used_by.len > 0)
+                allocs.push_back(inst);
         }
     }
+    std::stable_sort(allocs.begin(), allocs.end(), [](koopa_raw_value_t a, koopa_raw_value_t b) {
+        return array_len(a->ty->data.pointer.base) < array_len(b->ty->data.pointer.base);
+    });
+    Stack::loc_map.clear();
+    int current_loc = A + S;
+    for (auto inst : allocs) {
+        Stack::Insert(inst, current_loc);
+        current_loc += 4 * array_len(inst->ty->data.pointer.base);
+    }
+
+    adjust_sp(-Stack::stack_frame_length);
     if (Stack::R != 0) {
         sw_safe("ra", Stack::stack_frame_length - 4);
     }
+    for (size_t i = 0; i < allocation.used_callee_saved.size(); i++)
+        sw_safe(RegAlloc::name(allocation.used_callee_saved[i]), Stack::saved_base + 4 * i);
+
+    // 参数放到分配好的位置, 前 8 个在 a0-a7, 之后的在调用者的栈帧里
+    for (size_t i = 0; i < func->params.len; i++) {
+        auto param = (koopa_raw_value_t)func->params.buffer[i];
+        int loc = ParallelMove::location_of(param);
+        if (loc == ParallelMove::NONE)
+            continue;
+        if (i < 8)
+            ParallelMove::add(loc, RegAlloc::A0 + i);
+        else
+            ParallelMove::add(loc, ParallelMove::STACK + Stack::stack_frame_length + 4 * (i - 8));
+    }
+    ParallelMove::flush();
 
-    Stack::current_loc = A;
     // 访问所有基本块
     Visit(func->bbs);
 
-    std::cout << std::endl;
+    asm_out << '\n';
+
+    // 把这个函数的汇编取出来做窥孔优化再写回去
+    if (Peephole::enabled()) {
+        std::string text;
+        asm_out.take(start, text);
+        Peephole::Run(text, asm_out);
+    }
 }
 
 // 访问基本块
 void Visit(const koopa_raw_basic_block_t &bb)
 {
     // 执行一些其他的必要操作
-    std::cout << bb->name + 1 << ":" << std::endl;
-    assert(bb->params.len <= 8);
-
-    for (int i = 0; i < bb->params.len; i++) {
-        distribute_reg((koopa_raw_value_t)bb->params.buffer[i]);
-    }
+    asm_out << bb->name + 1 << ":" << '\n';
+    current_bb = bb;
+    // 基本块参数由跳转过来的地方直接放进了分配好的位置
 
     // ...
     // 访问所有指令
@@ -347,25 +520,17 @@ void Visit(const koopa_raw_value_t &value)
         Visit(kind.data.ret);
         break;
     case KOOPA_RVT_ALLOC:
-        // 访问 alloc 指令
-        if (value->used_by.len > 0) {
-            Stack::Insert(value, Stack::current_loc);
-            Stack::current_loc += 4 * array_len(value->ty->data.pointer.base);
-        }
+        // alloc 的位置在访问函数时已经排好
         break;
     case KOOPA_RVT_GLOBAL_ALLOC:
         // 访问 global_alloc 指令
-        std::cout << "  .globl " << value->name+1 << std::endl;
-        std::cout << value->name+1 << ":" << std::endl;
+        asm_out << "  .globl " << value->name+1 << '\n';
+        asm_out << value->name+1 << ":" << '\n';
         Visit(kind.data.global_alloc);
         break;
     case KOOPA_RVT_BINARY:
         // 访问 binary 指令
         Visit(kind.data.binary, value);
-        if (value->used_by.len > 0) {
-            Stack::Insert(value, Stack::current_loc);
-            Stack::current_loc += 4;
-        }
         break;
     case KOOPA_RVT_STORE:
         // 访问 store 指令
@@ -374,10 +539,6 @@ void Visit(const koopa_raw_value_t &value)
     case KOOPA_RVT_LOAD:
         // 访问 load 指令
         Visit(kind.data.load, value);
-        if (value->used_by.len > 0) {
-            Stack::Insert(value, Stack::current_loc);
-            Stack::current_loc += 4;
-        }
         break;
     case KOOPA_RVT_BRANCH:
         // 访问 branch 指令
@@ -390,31 +551,18 @@ void Visit(const koopa_raw_value_t &value)
     case KOOPA_RVT_CALL:
         // 访问 call 指令
         Visit(kind.data.call, value);
-        if (value->used_by.len > 0) {
-            Stack::Insert(value, Stack::current_loc);
-            Stack::current_loc += 4;
-        }
-        clear_reg_info();
         break;
     case KOOPA_RVT_GET_ELEM_PTR:
         Visit(kind.data.get_elem_ptr, value);
-        if (value->used_by.len > 0) {
-            Stack::Insert(value, Stack::current_loc);
-            Stack::current_loc += 4;
-        }
         break;
     case KOOPA_RVT_GET_PTR:
         Visit(kind.data.get_ptr, value);
-        if (value->used_by.len > 0) {
-            Stack::Insert(value, Stack::current_loc);
-            Stack::current_loc += 4;
-        }
         break;
     default:
         // 其他类型暂时遇不到
         assert(false);
     }
-    std::cout << std::endl;
+    asm_out << '\n';
 }
 
 // 访问对应类型指令的函数定义略
@@ -425,118 +573,104 @@ void Visit(const koopa_raw_value_t &value)
 void Visit(const koopa_raw_return_t &ret)
 {
     if (ret.value != nullptr) {
-        std::string value = distribute_reg(ret.value);
-        std::cout << "  mv a0," << value << std::endl;
+        Stack::Load2reg(ret.value, "a0");
     }
     if (Stack::R != 0) {
         lw_safe("ra", Stack::stack_frame_length - 4);
     }
-    clear_reg_info();
-    if (Stack::stack_frame_length > 0) {
-        if (Stack::stack_frame_length < 2048)
-            std::cout << "  addi sp, sp, " << Stack::stack_frame_length << std::endl;
-        else {
-            std::cout << "  li t6, " << Stack::stack_frame_length << std::endl;
-            std::cout << "  add sp, sp, t6" << std::endl;
-        }
-    }
-    std::cout << "  ret" << std::endl;
+    for (size_t i = 0; i < allocation.used_callee_saved.size(); i++)
+        lw_safe(RegAlloc::name(allocation.used_callee_saved[i]), Stack::saved_base + 4 * i);
+    adjust_sp(Stack::stack_frame_length);
+    asm_out << "  ret" << '\n';
 }
 
 // 访问二元运算指令
 void Visit(const koopa_raw_binary_t &binary, koopa_raw_value_t value)
 {
-    std::string reg_left = distribute_reg(binary.lhs);
-    std::string reg_right = distribute_reg(binary.rhs);
-    std::string reg_value = distribute_reg(value, false);
+    const char* reg_left = use_reg(binary.lhs, scratch0);
+    const char* reg_right = use_reg(binary.rhs, scratch1);
+    const char* reg_value = def_reg(value);
 
     switch (binary.op) {
         case KOOPA_RBO_NOT_EQ:
-            std::cout << "  sub "  << reg_value << ", " << reg_left     << ", " << reg_right    << std::endl;
-            std::cout << "  snez " << reg_value << ", " << reg_value                            << std::endl;
+            asm_out << "  sub "  << reg_value << ", " << reg_left     << ", " << reg_right    << '\n';
+            asm_out << "  snez " << reg_value << ", " << reg_value                            << '\n';
             break;
         case KOOPA_RBO_EQ:
-            std::cout << "  sub "  << reg_value << ", " << reg_left     << ", " << reg_right    << std::endl;
-            std::cout << "  seqz " << reg_value << ", " << reg_value                            << std::endl;
+            asm_out << "  sub "  << reg_value << ", " << reg_left     << ", " << reg_right    << '\n';
+            asm_out << "  seqz " << reg_value << ", " << reg_value                            << '\n';
             break;
         case KOOPA_RBO_GT:
-            std::cout << "  sgt "  << reg_value << ", " << reg_left     << ", " << reg_right    << std::endl;
+            asm_out << "  sgt "  << reg_value << ", " << reg_left     << ", " << reg_right    << '\n';
             break;
         case KOOPA_RBO_LT:
-            std::cout << "  slt "  << reg_value << ", " << reg_left     << ", " << reg_right    << std::endl;
+            asm_out << "  slt "  << reg_value << ", " << reg_left     << ", " << reg_right    << '\n';
             break;
         case KOOPA_RBO_GE:
-            std::cout << "  slt "  << reg_value << ", " << reg_left     << ", " << reg_right    << std::endl;
-            std::cout << "  seqz " << reg_value << ", " << reg_value                            << std::endl;
+            asm_out << "  slt "  << reg_value << ", " << reg_left     << ", " << reg_right    << '\n';
+            asm_out << "  seqz " << reg_value << ", " << reg_value                            << '\n';
             break;
         case KOOPA_RBO_LE:
-            std::cout << "  sgt "  << reg_value << ", " << reg_left     << ", " << reg_right    << std::endl;
-            std::cout << "  seqz " << reg_value << ", " << reg_value                            << std::endl;
+            asm_out << "  sgt "  << reg_value << ", " << reg_left     << ", " << reg_right    << '\n';
+            asm_out << "  seqz " << reg_value << ", " << reg_value                            << '\n';
             break;
         case KOOPA_RBO_ADD:
-            std::cout << "  add "  << reg_value << ", " << reg_left     << ", " << reg_right    << std::endl;
+            asm_out << "  add "  << reg_value << ", " << reg_left     << ", " << reg_right    << '\n';
             break;
         case KOOPA_RBO_SUB:
-            std::cout << "  sub "  << reg_value << ", " << reg_left     << ", " << reg_right    << std::endl;
+            asm_out << "  sub "  << reg_value << ", " << reg_left     << ", " << reg_right    << '\n';
             break;
         case KOOPA_RBO_MUL:
-            std::cout << "  mul "  << reg_value << ", " << reg_left     << ", " << reg_right    << std::endl;
+            asm_out << "  mul "  << reg_value << ", " << reg_left     << ", " << reg_right    << '\n';
             break;
         case KOOPA_RBO_DIV:
-            std::cout << "  div "  << reg_value << ", " << reg_left     << ", " << reg_right    << std::endl;
+            asm_out << "  div "  << reg_value << ", " << reg_left     << ", " << reg_right    << '\n';
             break;
         case KOOPA_RBO_MOD:
-            std::cout << "  rem "  << reg_value << ", " << reg_left     << ", " << reg_right    << std::endl;
+            asm_out << "  rem "  << reg_value << ", " << reg_left     << ", " << reg_right    << '\n';
             break;
         case KOOPA_RBO_AND:
-            std::cout << "  and "  << reg_value << ", " << reg_left     << ", " << reg_right    << std::endl;
+            asm_out << "  and "  << reg_value << ", " << reg_left     << ", " << reg_right    << '\n';
             break;
         case KOOPA_RBO_OR:
-            std::cout << "  or "   << reg_value << ", " << reg_left     << ", " << reg_right    << std::endl;
+            asm_out << "  or "   << reg_value << ", " << reg_left     << ", " << reg_right    << '\n';
             break;
         case KOOPA_RBO_XOR:
-            std::cout << "  xor "  << reg_value << ", " << reg_left     << ", " << reg_right    << std::endl;
+            asm_out << "  xor "  << reg_value << ", " << reg_left     << ", " << reg_right    << '\n';
             break;
         case KOOPA_RBO_SHL:
-            std::cout << "  sll "  << reg_value << ", " << reg_left     << ", " << reg_right    << std::endl;
+            asm_out << "  sll "  << reg_value << ", " << reg_left     << ", " << reg_right    << '\n';
             break;
         case KOOPA_RBO_SHR:
-            std::cout << "  srl "  << reg_value << ", " << reg_left     << ", " << reg_right    << std::endl;
+            asm_out << "  srl "  << reg_value << ", " << reg_left     << ", " << reg_right    << '\n';
             break;
         case KOOPA_RBO_SAR:
-            std::cout << "  sra "  << reg_value << ", " << reg_left     << ", " << reg_right    << std::endl;
+            asm_out << "  sra "  << reg_value << ", " << reg_left     << ", " << reg_right    << '\n';
             break;
         default:
             assert(false);
     }
 
-    check_used_inst(binary.lhs);
-    check_used_inst(binary.rhs);
-
-    // sw_safe(reg_value, Stack::current_loc);
+    finish_def(value, reg_value);
 }
 
 // 访问 store 指令
 void Visit(const koopa_raw_store_t &store)
 {
-    std::string reg_value = distribute_reg(store.value);
-    std::string reg_dest  = distribute_reg(store.dest);
-
-    std::cout << "  sw " << reg_value << ", 0(" << reg_dest << ")" << std::endl;
+    const char* reg_value = use_reg(store.value, scratch0);
+    auto dest = mem_operand(store.dest, scratch1);
 
-    check_used_inst(store.value);
-    check_used_inst(store.dest);
+    asm_out << "  sw " << reg_value << ", " << dest << '\n';
 }
 
 // 访问 load 指令
 void Visit(const koopa_raw_load_t &load, koopa_raw_value_t value)
 {
-    std::string reg_src  = distribute_reg(load.src);
-    std::string reg_dest = distribute_reg(value, false);
+    auto src = mem_operand(load.src, scratch0);
+    const char* reg_dest = def_reg(value);
 
-    std::cout << "  lw " << reg_dest << ", 0(" << reg_src << ")" << std::endl;
-    // sw_safe(reg_dest, Stack::current_loc);
-    check_used_inst(load.src);
+    asm_out << "  lw " << reg_dest << ", " << src << '\n';
+    finish_def(value, reg_dest);
 }
 
 // 访问global_alloc指令
@@ -544,10 +678,13 @@ void Visit(const koopa_raw_global_alloc_t &global_alloc)
 {
     switch (global_alloc.init->kind.tag) {
         case KOOPA_RVT_INTEGER:
-            std::cout << "  .word " << global_alloc.init->kind.data.integer.value << std::endl;
+            if (global_alloc.init->kind.data.integer.value == 0)
+                asm_out << "  .zero 4" << '\n';
+            else
+                asm_out << "  .word " << global_alloc.init->kind.data.integer.value << '\n';
             break;
         case KOOPA_RVT_ZERO_INIT:
-            std::cout << "  .zero " << 4*array_len(global_alloc.init->ty) << std::endl;
+            asm_out << "  .zero " << 4*array_len(global_alloc.init->ty) << '\n';
             break;
         case KOOPA_RVT_AGGREGATE:
             Visit(global_alloc.init->kind.data.aggregate);
@@ -562,121 +699,131 @@ void Visit(const koopa_raw_branch_t &branch)
 {
     if (branch.cond->kind.tag == KOOPA_RVT_INTEGER) {
         if (branch.cond->kind.data.integer.value) {
-            std::cout << "  j " << branch.true_bb->name + 1 << std::endl;
+            pass_block_args(branch.true_args, branch.true_bb);
+            asm_out << "  j " << branch.true_bb->name + 1 << '\n';
         } else {
-            std::cout << "  j " << branch.false_bb->name + 1 << std::endl;
+            pass_block_args(branch.false_args, branch.false_bb);
+            asm_out << "  j " << branch.false_bb->name + 1 << '\n';
         }
     } else {
-        std::string reg_cond = distribute_reg(branch.cond);
-        // 这里就比较dirty了，因为我只用了最简单的block_arg_ref，所以就写成这个样子了（甚至其实可以更简单）
-        for (int i = 0; i < branch.true_args.len; i++) {
-            assert(((koopa_raw_value_data_t*)branch.true_args.buffer[i])->kind.tag == KOOPA_RVT_INTEGER);
-            std::cout << "  li a" << i << ", " << ((koopa_raw_value_data_t*)branch.true_args.buffer[i])->kind.data.integer.value << std::endl;
-        }
-        for (int i = 0; i < branch.false_args.len; i++) {
-            assert(((koopa_raw_value_data_t*)branch.false_args.buffer[i])->kind.tag == KOOPA_RVT_INTEGER);
-            std::cout << "  li a" << i << ", " << ((koopa_raw_value_data_t*)branch.false_args.buffer[i])->kind.data.integer.value << std::endl;
-        }
-        clear_reg_info();
-        std::cout << "  bnez " << reg_cond << ", j2" << branch.true_bb->name + 1 << std::endl;
-        std::cout << "  j " << branch.false_bb->name + 1 << std::endl;
-        std::cout << "j2" << branch.true_bb->name + 1 << ":" << std::endl;
-        std::cout << "  j " << branch.true_bb->name + 1 << std::endl;
+        // bnez 的跳转范围只有 4KB, 先跳到紧跟着的标号, 再用 j 跳过去
+        // 两边的实参在各自的路径上分别传
+        const char* reg_cond = use_reg(branch.cond, scratch0);
+        std::string true_label = std::string("j2") + (current_bb->name + 1);
+        asm_out << "  bnez " << reg_cond << ", " << true_label << '\n';
+        pass_block_args(branch.false_args, branch.false_bb);
+        asm_out << "  j " << branch.false_bb->name + 1 << '\n';
+        asm_out << true_label << ":" << '\n';
+        pass_block_args(branch.true_args, branch.true_bb);
+        asm_out << "  j " << branch.true_bb->name + 1 << '\n';
     }
 }
 
 // 访问jump指令
 void Visit(const koopa_raw_jump_t &jump)
 {
-    for (int i = 0; i < jump.args.len; i++) {
-        std::string reg_arg = distribute_reg((koopa_raw_value_t)jump.args.buffer[i]);
-        std::cout << "  mv a" << i << ", " << reg_arg << std::endl;
-    }
-    clear_reg_info();
-    std::cout << "  j " << jump.target->name + 1 << std::endl;
+    pass_block_args(jump.args, jump.target);
+    asm_out << "  j " << jump.target->name + 1 << '\n';
 }
 
 // 访问call指令
 void Visit(const koopa_raw_call_t &call, koopa_raw_value_t value)
 {
+    // 实参可能就在 a 寄存器里, 作为一组并行赋值处理
     for (int i = 0; i < call.args.len; i++) {
-        std::string reg_arg = distribute_reg((koopa_raw_value_t)call.args.buffer[i]);
-        if (i < 8) {
-            std::cout << "  mv a" << i << ", " << reg_arg << std::endl;
-        } else {
-            sw_safe(reg_arg, 4*(i-8));
-        }
+        auto arg = (koopa_raw_value_t)call.args.buffer[i];
+        if (i < 8)
+            ParallelMove::add(RegAlloc::A0 + i, arg);
+        else
+            ParallelMove::add(ParallelMove::STACK + 4 * (i - 8), arg);
     }
-    clear_reg_info();
-    std::cout << "  call " << call.callee->name + 1 << std::endl;
+    ParallelMove::flush();
+    asm_out << "  call " << call.callee->name + 1 << '\n';
 
-    std::string reg_value = distribute_reg(value, false);
-    std::cout << "  mv " << reg_value << ", a0" << std::endl;
-
-    // sw_safe(reg_value, Stack::current_loc);
+    // 跨过调用还活着的值都在 s 寄存器或栈上, 结果直接从 a0 取
+    receive(value, "a0");
 }
 
-// 访问get_elem_ptr指令
-void Visit(const koopa_raw_get_elem_ptr_t &get_elem_ptr, koopa_raw_value_t value)
+// 数组元素的地址: src + index * size
+// 下标是常量时偏移在编译期算好
+static void emit_address(koopa_raw_value_t value, koopa_raw_value_t src, koopa_raw_value_t index, int multipler)
 {
-    std::string reg_src = distribute_reg(get_elem_ptr.src);
-    std::string reg_index = distribute_reg(get_elem_ptr.index);
-    std::string reg_value = distribute_reg(value, false);
+    const char* reg_src = use_reg(src, scratch0);
+    const char* reg_value = def_reg(value);
 
-    int multipler = 4 * array_len(get_elem_ptr.src->ty->data.pointer.base->data.array.base);
+    if (index->kind.tag == KOOPA_RVT_INTEGER) {
+        int offset = index->kind.data.integer.value * multipler;
+        if (offset >= -2048 && offset < 2048) {
+            asm_out << "  addi " << reg_value << ", " << reg_src << ", " << offset << '\n';
+        } else {
+            asm_out << "  li t6, " << offset << '\n';
+            asm_out << "  add " << reg_value << ", " << reg_src << ", t6" << '\n';
+        }
+        finish_def(value, reg_value);
+        return;
+    }
 
+    const char* reg_index = use_reg(index, scratch1);
+    // 偏移先算到 t6 里, 结果可能和 src/index 共用寄存器
     if ((multipler & (multipler - 1)) == 0) { // 是2的整数次幂
         int digits = log2(multipler);
-        std::cout << "  slli " << reg_index << ", " << reg_index << ", " << digits << std::endl;
+        asm_out << "  slli t6, " << reg_index << ", " << digits << '\n';
     } else {
-        std::cout << "  li " << reg_value << ", " << multipler << std::endl;
-        std::cout << "  mul " << reg_index << ", " << reg_index << ", " << reg_value << std::endl;
+        asm_out << "  li t6, " << multipler << '\n';
+        asm_out << "  mul t6, " << reg_index << ", t6" << '\n';
     }
-    std::cout << "  add " << reg_value << ", " << reg_src << ", " << reg_index << std::endl;
-    // sw_safe(reg_value, Stack::current_loc);
-    check_used_inst(get_elem_ptr.src);
-    check_used_inst(get_elem_ptr.index);
+    asm_out << "  add " << reg_value << ", " << reg_src << ", t6" << '\n';
+    finish_def(value, reg_value);
+}
+
+// 访问get_elem_ptr指令
+void Visit(const koopa_raw_get_elem_ptr_t &get_elem_ptr, koopa_raw_value_t value)
+{
+    int multipler = 4 * array_len(get_elem_ptr.src->ty->data.pointer.base->data.array.base);
+    emit_address(value, get_elem_ptr.src, get_elem_ptr.index, multipler);
 }
 
 // 访问get_ptr指令
 void Visit(const koopa_raw_get_ptr_t &get_ptr, koopa_raw_value_t value)
 {
-   std::string reg_src = distribute_reg(get_ptr.src);
-    std::string reg_index = distribute_reg(get_ptr.index);
-    std::string reg_value = distribute_reg(value, false);
-
     int multipler = 4 * array_len(get_ptr.src->ty->data.pointer.base);
-
-    if ((multipler & (multipler - 1)) == 0) { // 是2的整数次幂
-        int digits = log2(multipler);
-        std::cout << "  slli " << reg_index << ", " << reg_index << ", " << digits << std::endl;
-    } else {
-        std::cout << "  li " << reg_value << ", " << multipler << std::endl;
-        std::cout << "  mul " << reg_index << ", " << reg_index << ", " << reg_value << std::endl;
-    }
-    std::cout << "  add " << reg_value << ", " << reg_src << ", " << reg_index << std::endl;
-    // sw_safe(reg_value, Stack::current_loc);
-    check_used_inst(get_ptr.src);
-    check_used_inst(get_ptr.index);
+    emit_address(value, get_ptr.src, get_ptr.index, multipler);
 }
 
-// 访问aggregate指令
-void Visit(const koopa_raw_aggregate_t &aggregate)
+// 连续的 0 先攒着, 遇到非 0 的元素或者结束时合成一条 .zero
+static void emit_aggregate(const koopa_raw_aggregate_t &aggregate, size_t &zero_bytes)
 {
     for (int i = 0; i < aggregate.elems.len; i++) {
         auto value = (koopa_raw_value_t)aggregate.elems.buffer[i];
         switch (value->kind.tag) {
             case KOOPA_RVT_INTEGER:
-                std::cout << "  .word " << value->kind.data.integer.value << std::endl;
+                if (value->kind.data.integer.value == 0) {
+                    zero_bytes += 4;
+                    break;
+                }
+                if (zero_bytes > 0) {
+                    asm_out << "  .zero " << zero_bytes << '\n';
+                    zero_bytes = 0;
+                }
+                asm_out << "  .word " << value->kind.data.integer.value << '\n';
                 break;
             case KOOPA_RVT_ZERO_INIT:
-                std::cout << "  .zero " << 4*array_len(value->ty) << std::endl;
+                zero_bytes += 4 * array_len(value->ty);
                 break;
             case KOOPA_RVT_AGGREGATE:
-                Visit(value->kind.data.aggregate);
+                emit_aggregate(value->kind.data.aggregate, zero_bytes);
                 break;
             default:
                 assert(false);
         }
     }
-}
\ No newline at end of file
+}
+
+// 访问aggregate指令
+void Visit(const koopa_raw_aggregate_t &aggregate)
+{
+    size_t zero_bytes = 0;
+    emit_aggregate(aggregate, zero_bytes);
+    if (zero_bytes > 0)
+        asm_out << "  .zero " << zero_bytes << '\n';
+}
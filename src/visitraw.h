@@ -1,20 +1,20 @@
 #pragma once
 
 #include "koopa.h"
+#include "asmwriter.h"
 #include <string>
 
+// 所有生成的汇编都追加到这里, 由调用者在最后统一取走
+extern thread_local AsmWriter asm_out;
+
 namespace Stack {
     int Query(koopa_raw_value_t inst);
     void Insert(koopa_raw_value_t inst, int loc);
-    void Load2reg(koopa_raw_value_t value, std::string reg);
+    void Load2reg(koopa_raw_value_t value, const char* reg);
 }
 
-void lw_safe(std::string reg, int loc);
-void sw_safe(std::string reg, int loc);
-
-std::string distribute_reg(koopa_raw_value_t inst, bool use);
-inline std::string num2reg(int n);
-void clear_reg_info();
+void lw_safe(const char* reg, int loc);
+void sw_safe(const char* reg, int loc);
 
 void Visit(const koopa_raw_program_t &program);
 